@@ -0,0 +1,120 @@
+/*
+ * bench/bench.hpp
+ *
+ */
+
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+//
+// A minimal micro-benchmark harness.
+//
+// Benchmarks register themselves with BENCHMARK(name) { ... } and return
+// the number of operations they performed; main() runs each of them for at
+// least min_time and reports the time and the heap allocations per
+// operation (bench/main.cpp replaces operator new to count them).
+//
+// Reports, registered with REPORT(name) { ... }, are run instead with
+// --report and print tables of their own, e.g. accuracy against speed.
+//
+namespace bench {
+  inline std::atomic<uint64_t>& allocations()
+  {
+    static std::atomic<uint64_t> n(0);
+    return n;
+  }
+
+  // keeps the compiler from folding away memory updates that undo each
+  // other across loop iterations
+  inline void clobber()
+  {
+#if defined(__GNUC__)
+    asm volatile("" : : : "memory");
+#endif
+  }
+
+  using function = std::function<uint64_t()>;
+
+  inline std::vector<std::pair<std::string, function>>& registry()
+  {
+    static std::vector<std::pair<std::string, function>> r;
+    return r;
+  }
+
+  struct registrar {
+    registrar(std::string const& name, function f)
+    {
+      registry().emplace_back(name, f);
+    }
+  };
+
+  using report_function = std::function<void(std::ostream&)>;
+
+  inline std::vector<std::pair<std::string, report_function>>& reports()
+  {
+    static std::vector<std::pair<std::string, report_function>> r;
+    return r;
+  }
+
+  struct report_registrar {
+    report_registrar(std::string const& name, report_function f)
+    {
+      reports().emplace_back(name, f);
+    }
+  };
+
+  struct result {
+    std::string name;
+    uint64_t ops;
+    double ns_per_op;
+    double allocs_per_op;
+  };
+
+  inline result measure(std::string const& name, function const& f,
+                        std::chrono::duration<double> min_time)
+  {
+    using clock = std::chrono::steady_clock;
+
+    f(); // warm up
+
+    uint64_t ops = 0;
+    uint64_t const allocs = allocations();
+    auto const start = clock::now();
+    auto elapsed = clock::now() - start;
+    do {
+      ops += f();
+      elapsed = clock::now() - start;
+    } while (elapsed < min_time);
+
+    double const ns = std::chrono::duration<double, std::nano>(elapsed).count();
+    return result{name, ops, ns / ops, double(allocations() - allocs) / ops};
+  }
+}
+
+#define BENCH_CAT_(a, b) a ## b
+#define BENCH_CAT(a, b) BENCH_CAT_(a, b)
+
+#define BENCHMARK(name)                                                 \
+  static uint64_t BENCH_CAT(bench_, __LINE__)();                        \
+  static bench::registrar BENCH_CAT(registrar_, __LINE__)               \
+    (name, BENCH_CAT(bench_, __LINE__));                                \
+  static uint64_t BENCH_CAT(bench_, __LINE__)()
+
+#define REPORT(name)                                                    \
+  static void BENCH_CAT(report_, __LINE__)(std::ostream&);              \
+  static bench::report_registrar BENCH_CAT(report_registrar_, __LINE__) \
+    (name, BENCH_CAT(report_, __LINE__));                               \
+  static void BENCH_CAT(report_, __LINE__)(std::ostream& out)
+
+#endif // BENCH_HPP
+
+// vim: noai:ts=2:sw=2
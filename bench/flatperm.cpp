@@ -0,0 +1,40 @@
+/*
+ * bench/flatperm.cpp
+ *
+ */
+
+#include "bench/bench.hpp"
+
+#include "instance.hpp"
+
+#include <map>
+#include <memory>
+
+namespace {
+  //
+  // Whole flatperm tours on a fresh instance, one operation is one sampled
+  // step: its atmosphere, the pruning/enrichment decision and the
+  // histogram updates.
+  //
+  uint64_t tours(unsigned int N)
+  {
+    // an instance for each N, whose tours go on from one call to the next
+    static std::map<unsigned int, std::unique_ptr<instance>> instances;
+    auto& my_instance = instances[N];
+    if (not my_instance) {
+      my_instance.reset(new instance(N, 1));
+      my_instance->rng.seed(1);
+    }
+
+    uint64_t const samples = my_instance->samples;
+    for (int i = 0; i != 10; ++i)
+      my_instance->flatperm.tour(my_instance.get(), my_instance->flatperm.tours() + 1);
+    return my_instance->samples - samples;
+  }
+}
+
+BENCHMARK("flatperm/step/N=64")
+{ return tours(64); }
+
+BENCHMARK("flatperm/step/N=256")
+{ return tours(256); }
@@ -0,0 +1,197 @@
+/*
+ * bench/kernels.cpp
+ *
+ */
+
+#include "bench/bench.hpp"
+#include "bench/states.hpp"
+
+#include <map>
+#include <memory>
+#include <string>
+
+namespace {
+  using bench::point;
+  using bench::walk_type;
+
+  //
+  // A walk grown by flatperm to length n, with its features and the
+  // flatperm indices of each of its prefixes
+  //
+  struct state {
+    walk_type walk;
+    features::radius<point> radius;
+    features::multiplicity<walk_type> multiplicity;
+
+    using indices_type = instance::flatperm_type::indices_type;
+    std::vector<indices_type> indices;
+    my_array<long double, 2> histogram;
+    my_array<long double, 2, layouts::jagged<2>> jagged;
+    my_array<long double, 2, layouts::tiled<2>> tiled;
+
+    state(unsigned int n)
+      // one more step than n, so that the last one can be registered again
+      : walk(n + 1)
+      , histogram({n + 1, n / 2 + 1})
+      , jagged({n + 1, n / 2 + 1})
+      , tiled({n + 1, n / 2 + 1})
+    {
+      for (auto const& x : bench::grown_walk(n)) {
+        walk.register_step(x);
+        radius.register_step(walk);
+        multiplicity.register_step(walk);
+        indices.push_back(indices_type{{unsigned(walk.size()),
+                multiplicity.get<2>()}});
+      }
+    }
+  };
+
+  state& get_state(unsigned int n)
+  {
+    static std::map<unsigned int, std::unique_ptr<state>> states;
+    auto& s = states[n];
+    if (not s)
+      s.reset(new state(n));
+    return *s;
+  }
+
+  // keeps the results of the kernels alive
+  volatile uint64_t sink;
+
+  int const repeat = 1000;
+
+  // check_step on each neighbour of the last site
+  uint64_t check_step(unsigned int n)
+  {
+    auto const& walk = get_state(n).walk;
+    auto const neighbours = walk_type::lattice_type::get_neighbours(walk.back());
+
+    uint64_t allowed = 0;
+    for (int i = 0; i != repeat; ++i)
+      for (auto const& z : neighbours)
+        allowed += walk.check_step(z);
+    sink = allowed;
+    return repeat * neighbours.size();
+  }
+
+  uint64_t atmosphere(unsigned int n)
+  {
+    auto const& walk = get_state(n).walk;
+
+    uint64_t size = 0;
+    for (int i = 0; i != repeat; ++i)
+      size += walk.atmosphere().size();
+    sink = size;
+    return repeat;
+  }
+
+  // one operation is taking the last step back and making it again
+  uint64_t register_step(unsigned int n)
+  {
+    auto& walk = get_state(n).walk;
+    auto const z = walk.back();
+
+    for (int i = 0; i != repeat; ++i) {
+      walk.unregister_step();
+      walk.register_step(z);
+    }
+    return repeat;
+  }
+
+  uint64_t multiplicity(unsigned int n)
+  {
+    auto& s = get_state(n);
+
+    for (int i = 0; i != repeat; ++i) {
+      s.multiplicity.unregister_step(s.walk);
+      s.multiplicity.register_step(s.walk);
+      bench::clobber();
+    }
+    sink = s.multiplicity.get<2>();
+    return repeat;
+  }
+
+  uint64_t radius(unsigned int n)
+  {
+    auto& s = get_state(n);
+
+    for (int i = 0; i != repeat; ++i) {
+      s.radius.unregister_step(s.walk);
+      s.radius.register_step(s.walk);
+      bench::clobber();
+    }
+    sink = s.radius.get_norm_square_sum();
+    return repeat;
+  }
+
+  // my_array::operator() along the indices met growing the walk
+  uint64_t histogram(unsigned int n)
+  {
+    auto& s = get_state(n);
+
+    for (auto const& i : s.indices)
+      s.histogram(i) += 1;
+    return s.indices.size();
+  }
+
+  // my_array::next_row and previous_row along the indices met growing the
+  // walk and back, as basic_instance::advance and unregister_step do
+  template<typename Array>
+  uint64_t rows(Array& histogram, std::vector<state::indices_type> const& indices)
+  {
+    size_t at = 0, row = 0, m = 0;
+    for (auto const& i : indices) {
+      at = histogram.next_row(at, row, m, i[1]);
+      row = i[0];
+      m = i[1];
+      histogram.at(at) += 1;
+    }
+    for (auto i = indices.rbegin() + 1; i != indices.rend(); ++i) {
+      at = histogram.previous_row(at, row, m, (*i)[1]);
+      row = (*i)[0];
+      m = (*i)[1];
+      histogram.at(at) += 1;
+    }
+    bench::clobber();
+    return 2 * indices.size() - 1;
+  }
+
+  uint64_t rows_jagged(unsigned int n)
+  {
+    auto& s = get_state(n);
+    return rows(s.jagged, s.indices);
+  }
+
+  uint64_t rows_tiled(unsigned int n)
+  {
+    auto& s = get_state(n);
+    return rows(s.tiled, s.indices);
+  }
+
+  //////////////////////////////////////////////////////////////////////
+
+  int register_all()
+  {
+    using kernel = uint64_t (*)(unsigned int);
+    std::pair<char const*, kernel> const kernels[] = {
+      { "check_step",    check_step    },
+      { "atmosphere",    atmosphere    },
+      { "register_step", register_step },
+      { "multiplicity",  multiplicity  },
+      { "radius",        radius        },
+      { "histogram",     histogram     },
+      { "rows_jagged",   rows_jagged   },
+      { "rows_tiled",    rows_tiled    },
+    };
+
+    for (auto const& k : kernels)
+      for (unsigned int n : { 64, 256, 1024, 4096 }) {
+        auto const f = k.second;
+        bench::registrar(std::string("kernel/") + k.first + "/n=" + std::to_string(n),
+                         [f, n] { return f(n); });
+      }
+    return 0;
+  }
+
+  int const registered = register_all();
+}
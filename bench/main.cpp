@@ -0,0 +1,111 @@
+/*
+ * bench/main.cpp
+ *
+ */
+
+#include "bench/bench.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <new>
+
+//////////////////////////////////////////////////////////////////////
+// count every heap allocation
+//////////////////////////////////////////////////////////////////////
+
+void* operator new(std::size_t size)
+{
+  bench::allocations()++;
+  if (void* p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+namespace {
+  void print_text(std::vector<bench::result> const& results)
+  {
+    for (auto const& r : results)
+      std::cout << std::left << std::setw(40) << r.name
+                << std::right << std::setw(12) << std::fixed << std::setprecision(1)
+                << r.ns_per_op << " ns/op"
+                << std::setw(10) << std::setprecision(3)
+                << r.allocs_per_op << " allocs/op\n";
+  }
+
+  void print_csv(std::vector<bench::result> const& results)
+  {
+    std::cout << "name,ops,ns_per_op,allocs_per_op\n";
+    for (auto const& r : results)
+      std::cout << r.name << "," << r.ops << "," << r.ns_per_op << ","
+                << r.allocs_per_op << "\n";
+  }
+
+  void print_json(std::vector<bench::result> const& results)
+  {
+    std::cout << "{\n  \"benchmarks\": [";
+    for (auto i = results.begin(); i != results.end(); ++i)
+      std::cout << (i == results.begin() ? "\n" : ",\n")
+                << "    { \"name\": \"" << i->name << "\""
+                << ", \"ops\": " << i->ops
+                << ", \"ns_per_op\": " << i->ns_per_op
+                << ", \"allocs_per_op\": " << i->allocs_per_op << " }";
+    std::cout << "\n  ]\n}\n";
+  }
+}
+
+//
+// bench [--csv | --json | --report] [filter]
+//
+// runs the benchmarks whose name contains filter (all of them by default)
+// and prints the results as a table, as CSV or as JSON; with --report runs
+// the reports instead
+//
+int main(int argc, char* argv[])
+{
+  auto print = print_text;
+  bool report = false;
+  char const* filter = "";
+
+  for (int i = 1; i != argc; ++i) {
+    if (std::strcmp(argv[i], "--csv") == 0)
+      print = print_csv;
+    else if (std::strcmp(argv[i], "--json") == 0)
+      print = print_json;
+    else if (std::strcmp(argv[i], "--report") == 0)
+      report = true;
+    else
+      filter = argv[i];
+  }
+
+  if (report) {
+    for (auto const& r : bench::reports()) {
+      if (not std::strstr(r.first.c_str(), filter))
+        continue;
+      std::cout << "# " << r.first << "\n";
+      r.second(std::cout);
+    }
+    return 0;
+  }
+
+  std::vector<bench::result> results;
+  for (auto const& b : bench::registry()) {
+    if (not std::strstr(b.first.c_str(), filter))
+      continue;
+    results.push_back(bench::measure(b.first, b.second, std::chrono::milliseconds(500)));
+  }
+
+  print(results);
+}
@@ -0,0 +1,67 @@
+/*
+ * bench/random.cpp
+ *
+ */
+
+#include "bench/bench.hpp"
+
+#include "random_engines.hpp"
+
+#include <array>
+#include <random>
+
+namespace {
+  //
+  // The random draws of a flatperm step: one uniform01 for a pruning
+  // decision, one shuffle of an atmosphere for an enrichment. Compare with
+  // flatperm/step for their share of a step.
+  //
+  volatile double sink;
+
+  int const repeat = 1000;
+
+  template<typename Engine>
+  uint64_t uniform01()
+  {
+    static Engine g(1);
+
+    double sum = 0;
+    for (int i = 0; i != repeat; ++i)
+      sum += engines::uniform01(g);
+    sink = sum;
+    return repeat;
+  }
+
+  template<typename Engine>
+  uint64_t shuffle()
+  {
+    static Engine g(1);
+    static std::array<int, 6> atmosphere = {{ 0, 1, 2, 3, 4, 5 }};
+
+    for (int i = 0; i != repeat; ++i)
+      engines::shuffle(atmosphere.begin(), atmosphere.end(), g);
+    sink = atmosphere[0];
+    return repeat;
+  }
+
+  using xoshiro = engines::xoshiro256pp;
+  using philox = engines::philox4x32;
+}
+
+BENCHMARK("random/uniform01/mt19937")
+{ return uniform01<std::mt19937>(); }
+
+BENCHMARK("random/uniform01/xoshiro256pp")
+{ return uniform01<xoshiro>(); }
+
+BENCHMARK("random/uniform01/philox4x32")
+{ return uniform01<philox>(); }
+
+BENCHMARK("random/shuffle6/mt19937")
+{ return shuffle<std::mt19937>(); }
+
+BENCHMARK("random/shuffle6/xoshiro256pp")
+{ return shuffle<xoshiro>(); }
+
+BENCHMARK("random/shuffle6/philox4x32")
+{ return shuffle<philox>(); }
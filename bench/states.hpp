@@ -0,0 +1,84 @@
+/*
+ * bench/states.hpp
+ *
+ */
+
+#ifndef BENCH_STATES_HPP
+#define BENCH_STATES_HPP
+
+#include "instance.hpp"
+
+#include <map>
+#include <random>
+#include <vector>
+
+//
+// Realistic walk states for the kernel benchmarks: walks of a given length
+// grown by flatperm, rather than straight lines or kinetic growth walks
+// that get trapped early. The flatperm here is indexed by length only, so
+// that its histograms stay small for long walks.
+//
+namespace bench {
+  using point = instance::point;
+  using walk_type = instance::walk_type;
+
+  class grower {
+    using flatperm_type = algorithm::flatperm<1, instance::lattice, std::mt19937>;
+
+    std::mt19937 rng;
+    std::vector<point>& _out;
+
+  public:
+    unsigned int const N;
+    flatperm_type flatperm;
+    walk_type walk;
+
+    grower(unsigned int N, std::vector<point>& out)
+      : rng(1)
+      , _out(out)
+      , N(N)
+      , flatperm({N+1}, 1, rng)
+      , walk(N)
+    { }
+
+    walk_type::atmosphere_type atmosphere() const { return walk.atmosphere(); }
+
+    void register_step(point const& x, long double&)
+    {
+      walk.register_step(x);
+      // the histograms are dense and indexed by length only, the cell of
+      // the walk is at its length
+      flatperm.indices[0] = walk.size();
+      flatperm.offset = walk.size();
+      if (walk.size() == N and _out.empty())
+        _out.assign(walk.begin() + 1, walk.end());
+    }
+
+    void unregister_step()
+    {
+      walk.unregister_step();
+      flatperm.indices[0] = walk.size();
+      flatperm.offset = walk.size();
+    }
+  };
+
+  //
+  // The steps of the first walk of length n met by flatperm, computed once
+  //
+  inline std::vector<point> const& grown_walk(unsigned int n)
+  {
+    static std::map<unsigned int, std::vector<point>> walks;
+
+    auto& steps = walks[n];
+    if (steps.empty()) {
+      grower g(n, steps);
+      while (steps.empty())
+        g.flatperm.tour(&g, g.flatperm.tours() + 1);
+    }
+    return steps;
+  }
+}
+
+#endif // BENCH_STATES_HPP
+
+// vim: noai:ts=2:sw=2
@@ -0,0 +1,70 @@
+/*
+ * bench/walk.cpp
+ *
+ */
+
+#include "bench/bench.hpp"
+
+#include "lattice.hpp"
+#include "walk.hpp"
+
+#include <random>
+
+namespace {
+  using lattice = lattices::triangular;
+  using packed = lattices::packed_triangular;
+
+  //
+  // Grow a walk choosing each step at random from its atmosphere, until it
+  // is trapped or reaches length N, then shrink it back to the origin. One
+  // operation is one step: its atmosphere, register_step and
+  // unregister_step.
+  //
+  // Each Walk and N has a walk and a generator of its own, so that the
+  // walk always has room for N steps.
+  //
+  template<typename Walk, unsigned int N>
+  uint64_t grow_and_shrink()
+  {
+    static std::mt19937 rng(1);
+    static Walk walk(N);
+
+    uint64_t steps = 0;
+    for (int i = 0; i != 100; ++i) {
+      while (walk.size() < N) {
+        auto const atmo = walk.atmosphere();
+        if (atmo.empty())
+          break;
+        walk.register_step(atmo[rng() % atmo.size()]);
+        steps ++;
+      }
+      while (walk.size() > 0)
+        walk.unregister_step();
+    }
+    return steps;
+  }
+}
+
+BENCHMARK("walk/step/hashed/N=64")
+{ return grow_and_shrink<models::walk<lattice, sites::hashed>, 64>(); }
+
+BENCHMARK("walk/step/grid/N=64")
+{ return grow_and_shrink<models::walk<lattice, sites::grid>, 64>(); }
+
+BENCHMARK("walk/step/hashed/N=4096")
+{ return grow_and_shrink<models::walk<lattice, sites::hashed>, 4096>(); }
+
+BENCHMARK("walk/step/grid/N=4096")
+{ return grow_and_shrink<models::walk<lattice, sites::grid>, 4096>(); }
+
+BENCHMARK("walk/step/packed-hashed/N=64")
+{ return grow_and_shrink<models::walk<packed, sites::hashed>, 64>(); }
+
+BENCHMARK("walk/step/packed-grid/N=64")
+{ return grow_and_shrink<models::walk<packed, sites::grid>, 64>(); }
+
+BENCHMARK("walk/step/packed-hashed/N=4096")
+{ return grow_and_shrink<models::walk<packed, sites::hashed>, 4096>(); }
+
+BENCHMARK("walk/step/packed-grid/N=4096")
+{ return grow_and_shrink<models::walk<packed, sites::grid>, 4096>(); }
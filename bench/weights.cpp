@@ -0,0 +1,223 @@
+/*
+ * bench/weights.cpp
+ *
+ */
+
+#include "bench/bench.hpp"
+
+#include "instance.hpp"
+
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <vector>
+
+namespace {
+  //
+  // Whole flatperm tours as in bench/flatperm.cpp, for each weight type
+  //
+  template<typename Weight>
+  uint64_t tours(unsigned int N)
+  {
+    static basic_instance<Weight>* my_instance = [N] {
+      auto i = new basic_instance<Weight>(N, 1);
+      i->rng.seed(1);
+      return i;
+    }();
+
+    uint64_t const samples = my_instance->samples;
+    for (int i = 0; i != 10; ++i)
+      my_instance->flatperm.tour(my_instance, my_instance->flatperm.tours() + 1);
+    return my_instance->samples - samples;
+  }
+
+  //////////////////////////////////////////////////////////////////////
+
+  //
+  // An instance that also computes the weight of each of its samples in
+  // double_double, along the walk, and sums them in a double_double
+  // histogram. Comparing it with sW tells how much the arithmetic of Weight
+  // has lost, both in the products giving the weights and in their sums,
+  // on exactly the samples it produced. Both are divided by the power of
+  // two nearest (growth / mu)^n, roughly the size of the weights, so that
+  // the reference does not overflow; this division is exact.
+  //
+  // The pruning and enrichment of flatperm::grow are replayed in Weight to
+  // know what it decided, the reference weight then follows the same
+  // decisions: divided by the number of copies, or set to the target weight
+  // when the sample survived a pruning, and multiplied by the atmosphere
+  // over mu. Only a serial run of whole tours is followed.
+  //
+  template<typename Weight>
+  struct shadowed : basic_instance<Weight> {
+    using base = basic_instance<Weight>;
+    using exact = weights::double_double;
+
+    std::vector<int> scale;
+    std::vector<exact> shadow;
+
+    // the weight of each node of the current walk, as computed by flatperm
+    // and in double_double, scaled
+    std::vector<Weight> weight;
+    std::vector<exact> reference;
+
+    // x / 2^scale[n]
+    exact scaled(long double x, unsigned int n) const
+    {
+      return exact(std::ldexp(x, -scale[n]));
+    }
+
+    shadowed(unsigned int N, double mu, double growth)
+      : base(N, mu)
+      , scale(N + 1)
+      , shadow(N + 1)
+      , weight(N + 1, Weight(1))
+      , reference(N + 1, exact(1))
+    {
+      for (unsigned int n = 0; n <= N; ++n)
+        scale[n] = std::lround(n * std::log2(growth / mu));
+    }
+
+    void register_step(typename base::point const& x, Weight& W)
+    {
+      // the walk and the flatperm cell are still those of the parent
+      auto const& f = this->flatperm;
+      auto const n = this->walk.size();
+      auto const atmosphere = this->atmosphere().size();
+      auto const& cell = f.cells.at(f.offset);
+
+      long double const Srel = std::max<long double>(
+          f.tours() - std::floor(0.1 * n), 1);
+      Weight const target_weight = cell.sW / Srel;
+      Weight const tw_correction = cell.Se / Srel;
+      Weight const ratio = weight[n] / target_weight / tw_correction;
+
+      exact w;
+      if (ratio < 1.0) {
+        w = scaled(static_cast<long double>(cell.sW), n + 1) / exact(Srel)
+          * (exact(static_cast<long double>(cell.Se)) / exact(Srel));
+      } else {
+        using std::floor;
+        auto const copies = std::min(atmosphere,
+            (size_t) static_cast<long double>(floor(ratio)));
+        w = reference[n] / exact(copies)
+          * exact(std::ldexp(1.0L, scale[n] - scale[n + 1]));
+      }
+      reference[n + 1] = w * exact(atmosphere) / exact(f.mu);
+
+      base::register_step(x, W);
+      weight[n + 1] = W;
+      shadow[n + 1] += reference[n + 1];
+    }
+  };
+
+  struct outcome {
+    double samples_per_sec;
+    std::vector<double> error;
+  };
+
+  //
+  // S tours of a fresh instance, and the relative error of
+  // Z_n = sum_m sW(n, m) / S for each n
+  //
+  double const growth = 4.2;
+
+  template<typename Weight>
+  outcome run(unsigned int N, double mu, unsigned int S,
+              std::vector<unsigned int> const& ns)
+  {
+    shadowed<Weight> i(N, mu, growth);
+    i.rng.seed(1);
+
+    auto const start = std::chrono::steady_clock::now();
+    for (unsigned int s = 1; s <= S; ++s)
+      i.flatperm.tour(&i, s);
+    std::chrono::duration<double> const elapsed =
+      std::chrono::steady_clock::now() - start;
+
+    outcome result{i.samples / elapsed.count(), {}};
+
+    auto const& sW = i.flatperm.cells.field(histograms::fields::sW());
+    for (auto n : ns) {
+      weights::double_double Z = 0;
+      for (size_t m = 0; m != sW.row_extent(n); ++m)
+        Z += i.scaled(static_cast<long double>(sW.at(sW.offset(std::array<size_t, 2>{{ n, m }}))), n);
+      long double const exact = static_cast<long double>(i.shadow[n]);
+      result.error.push_back(std::fabs(static_cast<long double>(Z) / exact - 1));
+    }
+    return result;
+  }
+
+  //
+  // Throughput against the relative error on Z_n of each weight type.
+  // Walks reach length n only from tour n / 10 on, S must be large enough.
+  //
+  // A type whose range cannot hold the weights is not run: once they
+  // overflow, the ratios to the target weights are not numbers and every
+  // step is enriched, a tour never ends.
+  //
+  void accuracy(std::ostream& out, unsigned int N, double mu, unsigned int S)
+  {
+    std::vector<unsigned int> const ns = { N / 4, N / 2, N };
+
+    out << "N " << N << " mu " << mu << " tours " << S
+        << ", relative error of Z_n\n";
+    out << std::left << std::setw(16) << "weight"
+        << std::right << std::setw(14) << "samples/sec";
+    for (auto n : ns)
+      out << std::setw(12) << ("n=" + std::to_string(n));
+    out << "\n";
+
+    double const log_max_weight = N * std::log(growth / mu);
+
+    auto print = [&](char const* name, outcome const& o) {
+      out << std::left << std::setw(16) << name
+          << std::right << std::setw(14) << std::fixed << std::setprecision(0)
+          << o.samples_per_sec << std::scientific << std::setprecision(2);
+      for (auto e : o.error)
+        out << std::setw(12) << e;
+      out << std::defaultfloat << "\n";
+    };
+
+    auto overflows = [&](char const* name, double max) {
+      if (log_max_weight < std::log(max))
+        return false;
+      out << std::left << std::setw(16) << name
+          << std::right << std::setw(14) << "overflows" << "\n";
+      return true;
+    };
+
+    double const double_max = std::numeric_limits<double>::max();
+
+    if (not overflows("double", double_max))
+      print("double", run<double>(N, mu, S, ns));
+    print("long double", run<long double>(N, mu, S, ns));
+    if (not overflows("double_double", double_max))
+      print("double_double", run<weights::double_double>(N, mu, S, ns));
+    print("log_weight", run<weights::log_weight>(N, mu, S, ns));
+    out << "\n";
+  }
+}
+
+BENCHMARK("weights/step/double/N=256")
+{ return tours<double>(256); }
+
+BENCHMARK("weights/step/long-double/N=256")
+{ return tours<long double>(256); }
+
+BENCHMARK("weights/step/double-double/N=256")
+{ return tours<weights::double_double>(256); }
+
+BENCHMARK("weights/step/log/N=256")
+{ return tours<weights::log_weight>(256); }
+
+REPORT("weights/accuracy")
+{
+  accuracy(out, 256, 1, 200);
+  // the weights grow as 4.2^n and overflow a double past n ~ 490
+  accuracy(out, 512, 1, 60);
+  // about the growth constant, they stay of order one
+  accuracy(out, 512, 4.2, 60);
+}
@@ -0,0 +1,97 @@
+/*
+ * enrichment_stack.hpp
+ *
+ */
+
+#ifndef ENRICHMENT_STACK_HPP
+#define ENRICHMENT_STACK_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+namespace algorithm {
+  //
+  // The history of a flatperm tour: a stack of marks, the nodes of the
+  // enrichment tree with enrichments still to be explored.
+  //
+  // There is at most one mark per walk length and each has at most
+  // Coordination enrichments, so both the marks and a single buffer holding
+  // all the enrichments are allocated once, at construction. A mark refers
+  // to a slice of the buffer, which starts where the slice of the mark
+  // below ends. The owner of the tour takes enrichments from the back of
+  // the top mark, thieves (if any) from the front of any mark.
+  //
+  template<typename Point, std::size_t Coordination, typename Weight = long double>
+  class enrichment_stack {
+  public:
+    struct mark {
+      long unsigned int n;
+      Weight W;
+      std::size_t front, back;   // enrichments still pending
+      std::size_t stolen;        // enrichments taken from the front
+
+      bool exhausted() const { return front == back; }
+    };
+
+  private:
+    std::vector<mark> _marks;
+    std::vector<Point> _enrichments;
+    std::size_t _size;
+
+  public:
+    enrichment_stack(std::size_t max_marks = 0)
+      : _marks(max_marks)
+      , _enrichments(max_marks * Coordination)
+      , _size(0)
+    { }
+
+    bool empty() const { return _size == 0; }
+    std::size_t size() const { return _size; }
+
+    mark&       operator[](std::size_t i)       { return _marks[i]; }
+    mark const& operator[](std::size_t i) const { return _marks[i]; }
+
+    mark&       back()       { assert(_size > 0); return _marks[_size - 1]; }
+    mark const& back() const { assert(_size > 0); return _marks[_size - 1]; }
+
+    template<typename InputIterator>
+    void push(long unsigned int n, Weight W,
+              InputIterator first, InputIterator last)
+    {
+      assert(_size < _marks.size());
+      std::size_t const begin = empty() ? 0 : back().back;
+      std::size_t const end = std::copy(first, last,
+                                        _enrichments.begin() + begin)
+        - _enrichments.begin();
+      assert(end - begin <= Coordination);
+      _marks[_size++] = mark{n, W, begin, end, 0};
+    }
+
+    void pop()
+    {
+      assert(_size > 0);
+      --_size;
+    }
+
+    // take the last enrichment of the top mark
+    Point const& take()
+    {
+      assert(not back().exhausted());
+      return _enrichments[--back().back];
+    }
+
+    // take the first enrichment of any mark
+    Point const& steal(mark& m)
+    {
+      assert(not m.exhausted());
+      m.stolen++;
+      return _enrichments[m.front++];
+    }
+  };
+}
+
+#endif // ENRICHMENT_STACK_HPP
+
+// vim: noai:ts=2:sw=2
@@ -10,12 +10,21 @@
 
 #include <array>
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <exception>
 #include <initializer_list>
+#include <memory>
+#include <mutex>
 #include <random>
+#include <vector>
 
 #include "my_array.hpp"
+#include "histograms.hpp"
+#include "enrichment_stack.hpp"
+#include "metrics.hpp"
+#include "random_engines.hpp"
+#include "weights.hpp"
 
 #include <boost/thread/thread.hpp>
 
@@ -33,8 +42,44 @@ struct better_array : public std::array<T, N> {
 };
 
 namespace algorithm {
-  template<unsigned int D, typename RandomGenerator>
+  //
+  // A lock for data that is rarely contended. Moving it (along with the
+  // object that owns it) is only allowed while nobody holds it.
+  //
+  class spin_lock {
+    std::atomic<bool> locked;
+
+  public:
+    spin_lock() : locked(false) { }
+    spin_lock(spin_lock&&) : locked(false) { }
+
+    void lock() {
+      while (locked.exchange(true, std::memory_order_acquire))
+        ;
+    }
+
+    void unlock() {
+      locked.store(false, std::memory_order_release);
+    }
+  };
+
+  //
+  // Weight is the type of the weights and of the histograms summing them,
+  // long double or one of those in weights.hpp. Layout is where the cells
+  // of the histograms are kept (see my_array.hpp), jagged when the second
+  // index cannot exceed half the first. Histograms keeps them, separate or
+  // fused (see histograms.hpp).
+  //
+  template<unsigned int D, typename Lattice, typename RandomGenerator,
+           typename Weight = long double, typename Layout = layouts::dense<D>,
+           typename Histograms = histograms::separate<Weight, D, Layout>>
   struct flatperm {
+    using point = typename Lattice::point;
+    using weight_type = Weight;
+
+    template<typename T>
+    using histogram = my_array<T, D, Layout>;
+
     //////////////////////////////////////////////////
     // random number generator and distributions
     //////////////////////////////////////////////////
@@ -49,17 +94,33 @@ namespace algorithm {
     indices_type indices;
     const indices_type extents;
 
-    my_array<long double, D> sW, Se;
-    my_array<uint64_t, D> Sn, Enr, Pru;
+    // where the cell at indices is in the histograms, which the instance
+    // keeps up to date along with indices (see basic_instance::advance)
+    size_t offset = 0;
+
+    // sW, Se, Sn, Enr and Pru in each cell, along with those the instance
+    // keeps there
+    Histograms cells;
+    using cell_type = typename Histograms::cell_type;
 
     const long double mu;
 
+    // the cells modified since the last snapshot, so that a checkpoint can
+    // write only those
+    dirty_rows dirty;
+
+    // what the tours run by this flatperm have done so far, for other
+    // threads to read while they go on
+    std::unique_ptr<metrics::live> live;
+
     flatperm(std::initializer_list<unsigned int> extents_, double mu, RandomGenerator& rng)
     : rng(rng)
       , extents(extents_)
-      , sW(extents), Se(extents), Sn(extents)
-      , Enr(extents), Pru(extents)
+      , cells(extents)
       , mu(mu)
+      , dirty(extents[0])
+      , live(new metrics::live(extents[0]))
+      , history(extents[0])
     {
       std::cerr << "Flatperm initialized, ";
       std::cerr << "extents ";
@@ -68,170 +129,426 @@ namespace algorithm {
       std::cerr << ", weight renormalization set to " << mu << ".\n";
     }
 
+    //////////////////////////////////////////////////
+    // parallel runs
+    //////////////////////////////////////////////////
+
+    //
+    // The target weights of a parallel run: sW and Se summed over the tours
+    // of all the workers, and the number of those tours. They are published
+    // from time to time (see tour_parallel::publish) and the workers share
+    // the last one, which is never modified.
+    //
+    // sW and Se of a cell are kept together, whatever the histograms, so
+    // that a step reads a single line of them.
+    //
+    struct estimates {
+      struct target {
+        Weight sW, Se;
+
+        friend target operator+(target a, target const& b) {
+          a.sW += b.sW; a.Se += b.Se;
+          return a;
+        }
+      };
+
+      histogram<target> cells;
+      uint64_t S = 0;
+
+      explicit estimates(indices_type const& extents)
+        : cells(extents)
+      { }
+
+      void add(Histograms const& h)
+      {
+        for (size_t i = 0; i != h.num_elements(); ++i) {
+          auto&& cell = h.at(i);
+          cells.at(i).sW += cell.sW;
+          cells.at(i).Se += cell.Se;
+        }
+        S += h.at(0).Sn;
+      }
+
+      void add(estimates const& e)
+      {
+        cells += e.cells;
+        S += e.S;
+      }
+
+      void clear()
+      {
+        cells.fill(target());
+        S = 0;
+      }
+    };
+
+    // The estimates of a worker, which include what it sampled until
+    // some recent sync, but not the histograms above. None in a serial
+    // run, where these already hold everything.
+    std::shared_ptr<estimates const> targets;
+
+    uint64_t tours() const { return (targets ? targets->S : 0) + cells.at(0).Sn; }
+
+    void refresh(std::shared_ptr<estimates const> const& e)
+    {
+      targets = e;
+    }
+
+    // add the histograms of a worker to ours and reset them
+    void merge(flatperm& worker)
+    {
+      cells += worker.cells; worker.cells.clear();
+      dirty.merge(worker.dirty); worker.dirty.clear();
+    }
+
     ////////////////////////////////////////////////////
     //
     ////////////////////////////////////////////////////
+    //
+    // safe_point() is called before each tour, where the histograms, the
+    // walk and the random generator are consistent with each other (see
+    // algorithm::safe_point), the run stops when it returns false
+    //
+    template<typename T, typename SafePoint>
+    void run(T* instance, unsigned int Snew, SafePoint&& safe_point)
+    {
+      uint64_t S = tours();
+      uint64_t Smax = S + Snew;
+
+      std::cerr << "I already have " << S << " tours, starting " << Snew
+      << " up to " << Smax << "\n";
+
+      while (S < Smax) {
+        if (not safe_point()) {
+          std::cerr << "stopping after " << S << " tours\n";
+          return;
+        }
+        S += 1;
+        tour(instance, S);
+      }
+    }
+
     template<typename T>
     void run(T* instance, unsigned int Snew)
     {
-      std::uniform_real_distribution<double> uniform01;
+      run(instance, Snew, [] { return true; });
+    }
 
-      auto const Nmax = extents[0] - 1;
-      auto const& walk_size = indices[0];
+    //////////////////////////////////////////////////
+    // history management
+    //////////////////////////////////////////////////
 
-      //////////////////////////////////////////////////
-      // history management
-      //////////////////////////////////////////////////
+    using history_type = enrichment_stack<point, Lattice::coordination, Weight>;
+    using mark = typename history_type::mark;
 
-      typedef decltype(instance->atmosphere()) atmosphere_type;
+    history_type history;
 
-      struct mark {
-        long unsigned int n;
-        long double W;
-        atmosphere_type enrichments;
-      };
+    // the tour being run and, when continuing a stolen branch, the last
+    // enrichment before the history (see steal)
+    uint64_t current_tour = 0;
+    long unsigned int n_floor = 0;
 
-      std::vector<mark> history;
-      history.reserve(extents[0]);
+    // Set when other workers may steal from this history, which they do
+    // holding history_lock; the owner then takes it whenever it modifies
+    // the history.
+    bool shared = false;
+    spin_lock history_lock;
 
-      auto last_enrichment = [&] {
-        return history.empty() ? 0 : history.back().n;
+    void lock()   { if (shared) history_lock.lock(); }
+    void unlock() { if (shared) history_lock.unlock(); }
+
+    long unsigned int last_enrichment() const {
+      return history.empty() ? n_floor : history.back().n;
+    }
+
+    // a pending enrichment handed over to another worker
+    struct branch {
+      uint64_t S;
+      long unsigned int n_floor;
+      Weight W;
+      point next;
+      std::vector<point> prefix;
+    };
+
+    ////////////////////////////////////////////////////
+    // a single tour, S is its number (counting from 1)
+    ////////////////////////////////////////////////////
+    template<typename T>
+    void tour(T* instance, uint64_t S)
+    {
+      assert(history.empty());
+      assert(indices[0] == 0);
+
+      lock();
+      current_tour = S;
+      n_floor = 0;
+      unlock();
+
+      // a counter-based engine draws the numbers of tour S and no other
+      engines::restart(rng, S);
+
+      // begin new tour
+      indices.fill(0);
+      offset = 0;
+
+      Weight W = 1;
+
+      auto&& cell = cells.at(offset);
+      cell.sW += W;
+      cell.Sn += 1;
+      cell.Se += 1;
+      dirty.mark(indices);
+      live->started(S);
+
+      grow(instance, S, W);
+    }
+
+    ////////////////////////////////////////////////////
+    // continue a branch stolen from another worker
+    ////////////////////////////////////////////////////
+    template<typename T>
+    void resume(T* instance, branch const& b)
+    {
+      assert(history.empty());
+      assert(indices[0] == 0);
+
+      // rebuild the walk up to the enrichment, without sampling it again
+      for (auto const& x : b.prefix)
+        instance->advance(x);
+
+      lock();
+      current_tour = b.S;
+      n_floor = b.n_floor;
+      history.push(b.prefix.size(), b.W, &b.next, &b.next + 1);
+      unlock();
+
+      Weight W = b.W;
+      if (descend(instance, W))
+        grow(instance, b.S, W);
+    }
+
+    //
+    // Take the oldest pending enrichment, called by a thief.
+    //
+    // The serial algorithm explores the enrichments of a mark back to
+    // front, the first one taken from the front is therefore the last one
+    // it would have reached, when that mark is already gone: n_ind counts
+    // from the mark below it. Later ones count from the mark itself.
+    //
+    template<typename Walk>
+    bool steal(Walk const& walk, branch& b)
+    {
+      std::lock_guard<spin_lock> guard(history_lock);
+
+      for (std::size_t i = 0; i != history.size(); ++i) {
+        mark& m = history[i];
+        if (m.exhausted())
+          continue;
+
+        b.S = current_tour;
+        b.n_floor = m.stolen > 0 ? m.n : i > 0 ? history[i-1].n : n_floor;
+        b.W = m.W;
+        b.next = history.steal(m);
+        // the owner does not shrink the walk below m.n while m is around
+        b.prefix.assign(walk.begin() + 1, walk.begin() + m.n + 1);
+        return true;
+      }
+      return false;
+    }
+
+  private:
+    //
+    // Grow the walk from its current node until the history is exhausted.
+    //
+    // S is the number of the tour, which decides how long its walks can
+    // grow. Target weights are instead normalised by the number of tours
+    // they have been estimated from, the same in a serial run.
+    //
+    template<typename T>
+    void grow(T* instance, uint64_t S, Weight W)
+    {
+      uint64_t const S_seen = tours();
+
+      auto const Nmax = extents[0] - 1;
+      auto const& walk_size = indices[0];
+
+      // in a parallel run the estimates include the other workers' tours
+      estimates const* const e = targets.get();
+      using target = typename estimates::target;
+      auto estimate = [&](Weight const& w, Weight target::* t) {
+        return e ? w + e->cells.at(offset).*t : w;
       };
 
       const double delay = 0.1;
 
-      uint64_t S = sW.data()[0];
-      uint64_t Smax = S + Snew;
+      while (true) {
+        boost::this_thread::interruption_point();
 
-      std::cerr << "I already have " << S << " tours, starting " << Snew
-      << " up to " << Smax << "\n";
+        // Step 1 - get the atmosphere
+        auto atmo = instance->atmosphere();
 
-      while (S < Smax) {
-        assert(history.empty());
-        assert(walk_size == 0);
+        // all the statistics of this step are in the same cell
+        auto&& cell = cells.at(offset);
 
-        // begin new tour
-        indices.fill(0);
+        // Step 2 - prune or enrich
+        // The following piece compute 'copies' and possibily updates 'W'
 
-        S += 1;
-        long double W = 1;
-
-        sW(indices) += W;
-        Sn(indices) += 1;
-        Se(indices) += 1;
-
-        while (true) {
-          boost::this_thread::interruption_point();
-
-          // Step 1 - get the atmosphere
-          auto atmo = instance->atmosphere();
-
-          // Step 2 - prune or enrich
-          // The following piece compute 'copies' and possibily updates 'W'
-
-          size_t copies = 0;
-
-          if (walk_size < Nmax and not atmo.empty() and delay * walk_size < S) {
-            long double const Srel = S - std::floor(delay * walk_size);
-            long double const target_weight = sW(indices) / Srel;
-            long double const tw_correction = Se(indices) / Srel;
-            long double const ratio = W / target_weight / tw_correction;
-
-            if (ratio < 1.0) {
-              // probabilistic pruning
-              if (uniform01(rng) < ratio) {
-                copies = 1;
-                W /= ratio;
-              } else {
-                copies = 0;
-                W = 0;
-              }
+        size_t copies = 0;
+
+        if (walk_size < Nmax and not atmo.empty() and delay * walk_size < S) {
+          // at least 1, as it always is when S_seen == S
+          long double const Srel = std::max<long double>(
+              S_seen - std::floor(delay * walk_size), 1);
+          Weight const target_weight = estimate(cell.sW, &target::sW) / Srel;
+          Weight const tw_correction = estimate(cell.Se, &target::Se) / Srel;
+          Weight const ratio = W / target_weight / tw_correction;
+
+          if (ratio < 1.0) {
+            // probabilistic pruning
+            if (engines::uniform01(rng) < ratio) {
+              copies = 1;
+              W /= ratio;
             } else {
-              copies = std::min(atmo.size(), (size_t) floor(ratio));
-              W /= copies;
+              copies = 0;
+              W = 0;
             }
           } else {
-            copies = 0;
-            W = 0;
+            using std::floor;
+            copies = std::min(atmo.size(), (size_t) static_cast<long double>(floor(ratio)));
+            W /= copies;
           }
+        } else {
+          copies = 0;
+          W = 0;
+        }
 
-          // Standard RR step. It is alright doing it here, after having
-          // determined how many copies but before the actual
-          // pruning/enrichment, basically because the weight has not to
-          // change between "history" operations (push/pull).
-          W *= atmo.size() / mu;
-
-          // Step 3 - shrink and reload (if needed)
-          if (copies == 0) {
-            // stats
-            Pru(indices) ++;
-
-            // Shrink the walk
-            auto const n_last = last_enrichment();
-            while (walk_size > n_last)
-              instance->unregister_step();
+        // Standard RR step. It is alright doing it here, after having
+        // determined how many copies but before the actual
+        // pruning/enrichment, basically because the weight has not to
+        // change between "history" operations (push/pull).
+        W *= atmo.size() / mu;
+
+        if (copies == 0) {
+          // stats
+          cell.Pru ++;
+          live->pruned(walk_size);
+        } else {
+          assert(copies > 0);
+          assert(not atmo.empty());
+
+          // stats
+          cell.Enr += copies - 1;
+          live->enriched(walk_size, copies - 1);
+
+          // sample 'copies' from the atmosphere
+          engines::shuffle(atmo.begin(), atmo.end(), rng);
+
+          lock();
+          history.push(walk_size, W, atmo.begin(), atmo.begin() + copies);
+          unlock();
+        }
 
-            // check if we finished a tour
-            if (history.empty())
-              break;
+        if (not descend(instance, W))
+          break;
+      }
+    }
 
-            W = history.back().W;
-          } else {
-            assert(copies > 0);
-            assert(not atmo.empty());
+    //
+    // Step 3 and 4 - shrink the walk back to the last pending enrichment
+    // (if needed) and add it as a new node. Returns false when there is
+    // nothing left.
+    //
+    template<typename T>
+    bool descend(T* instance, Weight& W)
+    {
+      auto const& walk_size = indices[0];
 
-            // stats
-            Enr(indices) += copies - 1;
+      lock();
+      while (true) {
+        // marks left behind once thieves took what remained
+        while (not history.empty() and history.back().exhausted())
+          history.pop();
+
+        // Shrink the walk
+        auto const n_last = history.empty() ? 0 : history.back().n;
+        if (walk_size == n_last)
+          break;
+
+        unlock();
+        while (walk_size > n_last)
+          instance->unregister_step();
+        lock();
+      }
 
-            // sample 'copies' from the atmosphere
-            shuffle(begin(atmo), end(atmo), rng);
-            atmosphere_type enrichments;
-            enrichments.reserve(copies);
-            copy_n(begin(atmo), copies, back_inserter(enrichments));
+      // check if we finished a tour
+      if (history.empty()) {
+        unlock();
+        return false;
+      }
 
-            history.push_back(mark{walk_size, W, std::move(enrichments)});
-          }
+      mark& m = history.back();
+      W = m.W;
 
-          assert(not history.empty());
-          assert(not history.back().enrichments.empty());
+      auto const next_point = history.take();
 
-          auto const next_point = history.back().enrichments.back();
-          history.back().enrichments.pop_back();
+      // Step 4c - clean the history, unless thieves hold the rest of it
+      if (m.exhausted() and m.stolen == 0)
+        history.pop();
+      unlock();
 
-          // Step 4c - clean the history
-          if (history.back().enrichments.empty())
-            history.pop_back();
+      // Step 4 - Add a new node
+      instance->register_step(next_point, W);
 
-          // Step 4 - Add a new node
-          instance->register_step(next_point, W);
+      // Step 4b - compute n_ind
+      auto const n_ind = walk_size - last_enrichment();
 
-          // Step 4b - compute n_ind
-          auto const n_ind = walk_size - last_enrichment();
+      // Step 6 - Store the stats
+      auto&& cell = cells.at(offset);
+      cell.sW += W;
+      cell.Sn += 1;
+      cell.Se += (double) n_ind / walk_size;
+      // Enr and Pru are only updated where a sample has just been taken,
+      // as are the histograms of the instance
+      dirty.mark(indices);
+      live->sampled(walk_size, history.size());
 
-          // Step 6 - Store the stats
-          sW(indices) += W;
-          Sn(indices) += 1;
-          Se(indices) += (double) n_ind / walk_size;
-        }
-      }
+      return true;
     }
 
+  public:
     void load(hdf5::handle const& loc) {
-      std::cerr << "loading flatperm histograms: ";
-      std::cerr << "sW, ";  hdf5::load(loc, sW, "sW");
-      std::cerr << "Sn, ";  hdf5::load(loc, Sn, "Sn");
-      std::cerr << "Se, ";  hdf5::load(loc, Se, "Se");
-      std::cerr << "Enr, "; hdf5::load(loc, Enr, "Enr");
-      std::cerr << "Pru\n"; hdf5::load(loc, Pru, "Pru");
+      cells.load(loc);
+    }
+
+    //
+    // A copy of the histograms, which can be saved while the run goes on
+    // (see basic_instance::snapshot)
+    //
+    struct snapshot_type {
+      Histograms cells;
+
+      // the cells modified since the previous snapshot
+      dirty_rows dirty;
+
+      // only the dirty cells when incremental, onto the datasets written
+      // by the previous snapshot
+      void save(hdf5::handle const& loc,
+                hdf5::storage_map const& storage = hdf5::storage_map(),
+                bool incremental = false) const {
+        cells.save(loc, storage, incremental ? &dirty : nullptr);
+      }
+    };
+
+    // into h, whose storage is reused when it has the right extents; the
+    // dirty cells move to h
+    void snapshot(snapshot_type& h) {
+      h.cells = cells;
+      h.dirty = dirty;
+      dirty.clear();
     }
 
     void save(hdf5::handle const& loc) const {
-      std::cerr << "saving flatperm histograms: ";
-      std::cerr << "sW, ";  hdf5::save(loc, sW, "sW");
-      std::cerr << "Sn, ";  hdf5::save(loc, Sn, "Sn");
-      std::cerr << "Se, ";  hdf5::save(loc, Se, "Se");
-      std::cerr << "Enr, "; hdf5::save(loc, Enr, "Enr");
-      std::cerr << "Pru\n"; hdf5::save(loc, Pru, "Pru");
+      cells.save(loc);
     }
   };
 }
@@ -65,7 +65,7 @@ namespace hdf5 {
   // Non member functions
   //
   
-  attribute get_attribute(handle const& loc,
+  inline attribute get_attribute(handle const& loc,
 			  const char* obj_name,
 			  const char* attr_name)
   {
@@ -75,11 +75,19 @@ namespace hdf5 {
     return attribute(std::move(id));
   }
 
-  attribute get_attribute(handle const& loc,
+  inline attribute get_attribute(handle const& loc,
 			  const char* attr_name)
   {
     return get_attribute(loc, ".", attr_name);
   }
+
+  inline bool attribute_exists(handle const& loc,
+			       const char* attr_name)
+  {
+    htri_t r = H5Aexists_by_name(loc.getId(), ".", attr_name, H5P_DEFAULT);
+    if (r < 0) throw std::runtime_error("H5Aexists_by_name failed");
+    return r > 0;
+  }
 }
 
 #endif
@@ -10,6 +10,7 @@
 #include <hdf5.h>
 
 #include <stdexcept>
+#include <vector>
 
 namespace hdf5 {
   template<typename Base>
@@ -29,7 +30,39 @@ namespace hdf5 {
 
     template<typename Collection>
     Base& set_chunk(Collection const& dims) {
-      H5Pset_chunk(dcpl_id, dims.size(), dims.begin());
+      H5Pset_chunk(dcpl_id, dims.size(), &*dims.begin());
+      return *static_cast<Base*>(this);
+    }
+
+    // filters, in the order they are applied when writing; they all
+    // require a chunked layout
+
+    Base& set_shuffle() {
+      H5Pset_shuffle(dcpl_id);
+      return *static_cast<Base*>(this);
+    }
+
+    Base& set_deflate(unsigned int level) {
+      H5Pset_deflate(dcpl_id, level);
+      return *static_cast<Base*>(this);
+    }
+
+    // lossless for integer types
+    Base& set_scaleoffset_int() {
+      H5Pset_scaleoffset(dcpl_id, H5Z_SO_INT, H5Z_SO_INT_MINBITS_DEFAULT);
+      return *static_cast<Base*>(this);
+    }
+
+    Base& set_fletcher32() {
+      H5Pset_fletcher32(dcpl_id);
+      return *static_cast<Base*>(this);
+    }
+
+    template<typename Collection>
+    Base& set_filter(H5Z_filter_t filter, unsigned int flags,
+                     Collection const& cd_values) {
+      H5Pset_filter(dcpl_id, filter, flags, cd_values.size(),
+                    cd_values.empty() ? nullptr : &*cd_values.begin());
       return *static_cast<Base*>(this);
     }
   };
@@ -102,6 +135,34 @@ namespace hdf5 {
       return dataspace(H5Dget_space(getId()));
     }
 
+    // only for chunked datasets, within their maximum dimensions
+    void set_extent(hsize_t const* dims)
+    {
+      if (H5Dset_extent(getId(), dims) < 0)
+	throw std::runtime_error("H5Dset_extent failed");
+    }
+
+    H5D_layout_t get_layout() const
+    {
+      hid_t dcpl_id = H5Dget_create_plist(getId());
+      H5D_layout_t const layout = H5Pget_layout(dcpl_id);
+      H5Pclose(dcpl_id);
+      return layout;
+    }
+
+    // the extents of the chunks, none unless the layout is H5D_CHUNKED
+    std::vector<hsize_t> get_chunk() const
+    {
+      std::vector<hsize_t> dims;
+      hid_t dcpl_id = H5Dget_create_plist(getId());
+      if (H5Pget_layout(dcpl_id) == H5D_CHUNKED) {
+        dims.resize(H5Pget_chunk(dcpl_id, 0, NULL));
+        H5Pget_chunk(dcpl_id, dims.size(), dims.data());
+      }
+      H5Pclose(dcpl_id);
+      return dims;
+    }
+
     hsize_t get_storage_size() const
     {
       return H5Dget_storage_size(getId());
@@ -116,6 +177,14 @@ namespace hdf5 {
       return H5Dread(getId(), mem_type, mem_space, H5S_ALL, H5P_DEFAULT, buf);
     }
 
+    // the elements selected in file_space to those selected in mem_space
+    void read(datatype const& mem_type, dataspace const& mem_space,
+	      dataspace const& file_space, void *buf)
+    {
+      if (H5Dread(getId(), mem_type, mem_space, file_space, H5P_DEFAULT, buf) < 0)
+	throw std::runtime_error("H5Dread failed");
+    }
+
     template<typename T>
     const T read()
     {
@@ -135,6 +204,14 @@ namespace hdf5 {
       H5Dwrite(getId(), mem_type, mem_space, H5S_ALL, H5P_DEFAULT, buf);
     }
 
+    // the elements selected in mem_space to those selected in file_space
+    void write(datatype const& mem_type, dataspace const& mem_space,
+	       dataspace const& file_space, const void *buf)
+    {
+      if (H5Dwrite(getId(), mem_type, mem_space, file_space, H5P_DEFAULT, buf) < 0)
+	throw std::runtime_error("H5Dwrite failed");
+    }
+
     template<typename T>
     void write(dataspace const& mem_space, T const* buf)
     {
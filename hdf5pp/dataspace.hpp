@@ -15,6 +15,7 @@
 #include <array>
 #include <cassert>
 #include <initializer_list>
+#include <stdexcept>
 
 namespace hdf5 {
   using boost::enable_if;
@@ -82,17 +83,55 @@ namespace hdf5 {
     dataspace& select_all()
     {
       if (H5Sselect_all(id) < 0)
-	throw 1;
+	throw std::runtime_error("H5Sselect_all failed");
       return *this;
     }
 
     dataspace& select_none()
     {
       if (H5Sselect_none(id) < 0 )
-	throw 1;
+	throw std::runtime_error("H5Sselect_none failed");
       return *this;
     }
 
+    // start and count give a block for each dimension, op is how it
+    // combines with the current selection (e.g. H5S_SELECT_OR)
+    template<typename Collection>
+    dataspace& select_hyperslab(H5S_seloper_t op, Collection const& start,
+                                Collection const& count)
+    {
+      assert(start.size() == get_simple_extent_ndims());
+      assert(count.size() == start.size());
+      if (H5Sselect_hyperslab(id, op, &*start.begin(), NULL,
+                              &*count.begin(), NULL) < 0)
+	throw std::runtime_error("H5Sselect_hyperslab failed");
+      return *this;
+    }
+
+    // every stride-th block, as many as count gives
+    template<typename Collection>
+    dataspace& select_hyperslab(H5S_seloper_t op, Collection const& start,
+                                Collection const& stride,
+                                Collection const& count)
+    {
+      assert(start.size() == get_simple_extent_ndims());
+      assert(stride.size() == start.size() and count.size() == start.size());
+      if (H5Sselect_hyperslab(id, op, &*start.begin(), &*stride.begin(),
+                              &*count.begin(), NULL) < 0)
+	throw std::runtime_error("H5Sselect_hyperslab failed");
+      return *this;
+    }
+
+    template<typename Collection>
+    void get_simple_extent_dims(Collection& dims) const {
+      assert(dims.size() == get_simple_extent_ndims());
+      H5Sget_simple_extent_dims(id, &*dims.begin(), NULL);
+    }
+
+    hssize_t get_select_npoints() const {
+      return H5Sget_select_npoints(id);
+    }
+
     bool selection_valid() const {
       // Returns a positive value, for TRUE, if the selection is
       // contained within the extent or 0 (zero), for FALSE, if it is
@@ -5,6 +5,10 @@
 
 #include <boost/preprocessor/seq/for_each.hpp>
 #include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+#include <cstddef>
+#include <utility>
 
 #define HDF5_NAME_(type) BOOST_PP_CAT(__, type)
 
@@ -5,6 +5,8 @@
 
 #include <hdf5.h>
 
+#include <string>
+
 namespace hdf5 {
   class group : public handle {
   public:
@@ -19,7 +21,22 @@ namespace hdf5 {
     static
     group open(hid_t loc, std::string const& name)
     {
-      return H5Gopen(loc, name.c_str(), H5P_DEFAULT);
+      return group(H5Gopen(loc, name.c_str(), H5P_DEFAULT));
+    }
+
+    static
+    group create(hid_t loc, std::string const& name)
+    {
+      return group(H5Gcreate(loc, name.c_str(), H5P_DEFAULT, H5P_DEFAULT,
+                             H5P_DEFAULT));
+    }
+
+    static
+    group open_or_create(hid_t loc, std::string const& name)
+    {
+      return H5Lexists(loc, name.c_str(), H5P_DEFAULT) > 0
+        ? open(loc, name)
+        : create(loc, name);
     }
   };
 }
@@ -6,7 +6,9 @@
 #include "hdf5pp/dataspace.hpp"
 #include "hdf5pp/datatype.hpp"
 #include "hdf5pp/file.hpp"
+#include "hdf5pp/group.hpp"
 #include "hdf5pp/link.hpp"
+#include "hdf5pp/storage.hpp"
 // #include "hdf5pp/property.hpp"
 
 namespace hdf5 {
@@ -2,16 +2,25 @@
 #define LINK_HPP
 
 #include "hdf5pp/handle.hpp"
+#include <stdexcept>
 #include <string>
 
 namespace hdf5 {
-  bool link_exists(handle const& loc,
+  inline bool link_exists(handle const& loc,
 		   std::string const& name,
 		   hid_t lapl_id = H5P_DEFAULT)
   {
     htri_t r = H5Lexists(loc.getId(), name.c_str(), lapl_id);
     return (r > 0) ? true : false;
   }
+
+  inline void link_delete(handle const& loc,
+			  std::string const& name,
+			  hid_t lapl_id = H5P_DEFAULT)
+  {
+    if (H5Ldelete(loc.getId(), name.c_str(), lapl_id) < 0)
+      throw std::runtime_error("H5Ldelete failed");
+  }
 }
 
 #endif
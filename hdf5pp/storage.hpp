@@ -0,0 +1,112 @@
+#ifndef HDF5_STORAGE_HPP
+#define HDF5_STORAGE_HPP
+
+#include "hdf5pp/dataset.hpp"
+
+#include <hdf5.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace hdf5 {
+  //
+  // How a dataset is stored in the file, applied when it is created: an
+  // existing dataset keeps the layout it was created with.
+  //
+  // The default is the contiguous layout. Any filter needs chunks; when
+  // chunk is left empty they are chosen by whole trailing dimensions up to
+  // about chunk_bytes each. Chunk dimensions larger than the dataset are
+  // cut to its (maximum) extents.
+  //
+  struct storage {
+    std::vector<hsize_t> chunk;
+    bool shuffle = false;
+    unsigned int deflate = 0;        // gzip level 1 to 9, 0 for none
+    bool scaleoffset = false;        // integer datasets only
+    bool fletcher32 = false;
+
+    // any other filter, e.g. one built into HDF5 but not listed above
+    struct filter {
+      H5Z_filter_t id;
+      unsigned int flags;
+      std::vector<unsigned int> cd_values;
+    };
+    std::vector<filter> filters;
+
+    static const hsize_t chunk_bytes = 1 << 20;
+
+    // shuffle and deflate at the given level, the usual choice for
+    // histograms of numbers of similar size
+    static storage compressed(unsigned int level)
+    {
+      storage s;
+      s.shuffle = true;
+      s.deflate = level;
+      return s;
+    }
+
+    bool chunked() const
+    {
+      return not chunk.empty() or shuffle or deflate or scaleoffset
+        or fletcher32 or not filters.empty();
+    }
+
+    template<typename Create, typename Extents>
+    void apply(Create& params, Extents const& extents, size_t type_size) const
+    {
+      if (not chunked())
+        return;
+
+      std::vector<hsize_t> dims(std::begin(extents), std::end(extents));
+      if (chunk.size() == dims.size()) {
+        for (size_t i = 0; i != dims.size(); ++i)
+          dims[i] = std::max<hsize_t>(1, std::min(chunk[i], dims[i]));
+      } else {
+        hsize_t bytes = type_size;
+        for (size_t i = dims.size(); i-- != 0; ) {
+          dims[i] = std::max<hsize_t>(1, std::min(dims[i], chunk_bytes / bytes));
+          bytes *= dims[i];
+        }
+      }
+      params.set_chunk(dims);
+
+      if (scaleoffset)
+        params.set_scaleoffset_int();
+      if (shuffle)
+        params.set_shuffle();
+      if (deflate)
+        params.set_deflate(deflate);
+      for (auto const& f : filters)
+        params.set_filter(f.id, f.flags, f.cd_values);
+      if (fletcher32)
+        params.set_fletcher32();
+    }
+  };
+
+  //
+  // The storage of each dataset by name, falling back to a default one
+  //
+  class storage_map {
+    storage fallback;
+    std::map<std::string, storage> named;
+
+  public:
+    storage_map(storage fallback = storage()) : fallback(fallback) { }
+
+    storage_map& set(std::string const& name, storage const& s)
+    {
+      named[name] = s;
+      return *this;
+    }
+
+    storage const& operator()(std::string const& name) const
+    {
+      auto const i = named.find(name);
+      return i == named.end() ? fallback : i->second;
+    }
+  };
+}
+
+#endif
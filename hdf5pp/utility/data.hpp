@@ -11,7 +11,7 @@ namespace hdf5 {
   void const* data(T const& t) { return &t; }
 
   template<>
-  void const* data(std::string const& s) { return s.data(); }
+  inline void const* data(std::string const& s) { return s.data(); }
 }
 
 #endif
@@ -0,0 +1,386 @@
+/*
+ * histograms.hpp
+ *
+ */
+
+#ifndef HISTOGRAMS_HPP
+#define HISTOGRAMS_HPP
+
+#include "my_array.hpp"
+#include "weights.hpp"
+
+#include "hdf5pp/datatype/composite.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//
+// The histograms of a run, a cell for each value of the flatperm indices
+// holding
+//
+//   sW, Se, Sn, Enr, Pru   the flatperm statistics (see flatperm.hpp)
+//   Re2W, Rg2W, Rm2W       the weighted squared radii (see basic_instance)
+//
+// which are kept in one of two ways, chosen at build time (see HISTOGRAMS
+// in CMakeLists.txt and basic_instance):
+//
+//   separate  an array for each of them, the datasets sW, Se ... of the
+//             datafile
+//   fused     a single array of cells, so that a step touches the two or
+//             three cache lines of its cell rather than eight (a single
+//             one for double weights); the datafile has a compound dataset
+//             histograms instead
+//
+// Both give the cell at some indices as h(indices), whose offset is then
+// computed once for all of its fields, or at an offset kept up to date by
+// the caller as h.at(offset) (see next_row), and h.field(fields::sW()) the
+// array of one of them. Either reads the datafiles written by the other, and
+// removes the datasets of the other when it saves so that a datafile never
+// has both. The time series of the group history are only appended to.
+//
+namespace histograms {
+  template<typename Weight>
+  struct cell {
+    using weight_type = Weight;
+
+    Weight sW, Se;
+    uint64_t Sn, Enr, Pru;
+    Weight Re2W, Rg2W, Rm2W;
+
+    friend cell operator+(cell a, cell const& b) {
+      a.sW += b.sW; a.Se += b.Se;
+      a.Sn += b.Sn; a.Enr += b.Enr; a.Pru += b.Pru;
+      a.Re2W += b.Re2W; a.Rg2W += b.Rg2W; a.Rm2W += b.Rm2W;
+      return a;
+    }
+  };
+
+  // the fields of a cell, to ask for their arrays with field()
+  namespace fields {
+    struct sW   { template<typename Cell> static auto& of(Cell& c) { return c.sW; } };
+    struct Se   { template<typename Cell> static auto& of(Cell& c) { return c.Se; } };
+    struct Sn   { template<typename Cell> static auto& of(Cell& c) { return c.Sn; } };
+    struct Enr  { template<typename Cell> static auto& of(Cell& c) { return c.Enr; } };
+    struct Pru  { template<typename Cell> static auto& of(Cell& c) { return c.Pru; } };
+    struct Re2W { template<typename Cell> static auto& of(Cell& c) { return c.Re2W; } };
+    struct Rg2W { template<typename Cell> static auto& of(Cell& c) { return c.Rg2W; } };
+    struct Rm2W { template<typename Cell> static auto& of(Cell& c) { return c.Rm2W; } };
+  }
+
+  // a cell of separate histograms, its fields where they are stored
+  template<typename Weight>
+  struct cell_ref {
+    Weight& sW; Weight& Se;
+    uint64_t& Sn; uint64_t& Enr; uint64_t& Pru;
+    Weight& Re2W; Weight& Rg2W; Weight& Rm2W;
+
+    operator cell<Weight>() const {
+      return { sW, Se, Sn, Enr, Pru, Re2W, Rg2W, Rm2W };
+    }
+
+    cell_ref& operator=(cell<Weight> const& c) {
+      sW = c.sW; Se = c.Se;
+      Sn = c.Sn; Enr = c.Enr; Pru = c.Pru;
+      Re2W = c.Re2W; Rg2W = c.Rg2W; Rm2W = c.Rm2W;
+      return *this;
+    }
+  };
+
+  // the cell with other weights, through long double
+  template<typename To, typename From>
+  cell<To> convert(cell<From> const& c)
+  {
+    auto w = [](From const& x) { return To(static_cast<long double>(x)); };
+    return { w(c.sW), w(c.Se), c.Sn, c.Enr, c.Pru,
+             w(c.Re2W), w(c.Rg2W), w(c.Rm2W) };
+  }
+
+  // copy the cells of from, of the same extents, into to
+  template<typename From, typename To>
+  void copy(From& from, To& to)
+  {
+    for (size_t i = 0; i != to.num_elements(); ++i)
+      to.at(i) = from.at(i);
+  }
+
+  template<typename Weight, size_t D, typename Layout>
+  struct fused;
+
+  //////////////////////////////////////////////////////////////////////
+  // separate
+  //////////////////////////////////////////////////////////////////////
+
+  template<typename Weight, size_t D, typename Layout>
+  struct separate {
+    using cell_type = cell<Weight>;
+
+    template<typename T>
+    using array = my_array<T, D, Layout>;
+
+    array<Weight> sW, Se;
+    array<uint64_t> Sn, Enr, Pru;
+    array<Weight> Re2W, Rg2W, Rm2W;
+
+    separate() = default;
+
+    template<typename ExtentList>
+    separate(ExtentList const& extents)
+      : sW(extents), Se(extents)
+      , Sn(extents), Enr(extents), Pru(extents)
+      , Re2W(extents), Rg2W(extents), Rm2W(extents)
+    { }
+
+    size_t num_elements() const { return sW.num_elements(); }
+
+    // see layouts
+    size_t next_row(size_t at, size_t row, size_t m, size_t m_next) const {
+      return sW.next_row(at, row, m, m_next);
+    }
+
+    size_t previous_row(size_t at, size_t row, size_t m, size_t m_next) const {
+      return sW.previous_row(at, row, m, m_next);
+    }
+
+    cell_ref<Weight> at(size_t i) {
+      return { sW.data()[i], Se.data()[i],
+               Sn.data()[i], Enr.data()[i], Pru.data()[i],
+               Re2W.data()[i], Rg2W.data()[i], Rm2W.data()[i] };
+    }
+
+    cell_type at(size_t i) const {
+      return { sW.data()[i], Se.data()[i],
+               Sn.data()[i], Enr.data()[i], Pru.data()[i],
+               Re2W.data()[i], Rg2W.data()[i], Rm2W.data()[i] };
+    }
+
+    template<typename IndexList>
+    size_t offset(IndexList const& indices) const {
+      return sW.offset(indices);
+    }
+
+    template<typename IndexList>
+    cell_ref<Weight> operator()(IndexList const& indices) {
+      return at(sW.offset(indices));
+    }
+
+    array<Weight> const& field(fields::sW) const { return sW; }
+    array<Weight> const& field(fields::Se) const { return Se; }
+    array<uint64_t> const& field(fields::Sn) const { return Sn; }
+    array<uint64_t> const& field(fields::Enr) const { return Enr; }
+    array<uint64_t> const& field(fields::Pru) const { return Pru; }
+    array<Weight> const& field(fields::Re2W) const { return Re2W; }
+    array<Weight> const& field(fields::Rg2W) const { return Rg2W; }
+    array<Weight> const& field(fields::Rm2W) const { return Rm2W; }
+
+    separate& operator+=(separate const& o) {
+      sW += o.sW; Se += o.Se;
+      Sn += o.Sn; Enr += o.Enr; Pru += o.Pru;
+      Re2W += o.Re2W; Rg2W += o.Rg2W; Rm2W += o.Rm2W;
+      return *this;
+    }
+
+    void clear() {
+      sW.fill(0); Se.fill(0);
+      Sn.fill(0); Enr.fill(0); Pru.fill(0);
+      Re2W.fill(0); Rg2W.fill(0); Rm2W.fill(0);
+    }
+
+    void load(hdf5::handle const& loc);
+
+    //
+    // With dirty, only the cells it marks, onto the datasets written by a
+    // previous save (see hdf5::save)
+    //
+    void save(hdf5::handle const& loc,
+              hdf5::storage_map const& storage = hdf5::storage_map(),
+              dirty_rows const* dirty = nullptr) const {
+      if (hdf5::link_exists(loc, "histograms"))
+        hdf5::link_delete(loc, "histograms");
+      std::cerr << "saving histograms: ";
+      std::cerr << "sW, ";   hdf5::save(loc, sW, "sW", storage("sW"), dirty);
+      std::cerr << "Sn, ";   hdf5::save(loc, Sn, "Sn", storage("Sn"), dirty);
+      std::cerr << "Se, ";   hdf5::save(loc, Se, "Se", storage("Se"), dirty);
+      std::cerr << "Enr, ";  hdf5::save(loc, Enr, "Enr", storage("Enr"), dirty);
+      std::cerr << "Pru, ";  hdf5::save(loc, Pru, "Pru", storage("Pru"), dirty);
+      std::cerr << "Re2W, "; hdf5::save(loc, Re2W, "Re2W", storage("Re2W"), dirty);
+      std::cerr << "Rg2W, "; hdf5::save(loc, Rg2W, "Rg2W", storage("Rg2W"), dirty);
+      std::cerr << "Rm2W\n"; hdf5::save(loc, Rm2W, "Rm2W", storage("Rm2W"), dirty);
+    }
+
+    // to the time series of the group history, see basic_instance
+    void append(hdf5::handle const& history, hdf5::storage_map const& storage,
+                unsigned int stride) const {
+      auto append = [&](auto const& h, const char* name) {
+        hdf5::append(history, h, name,
+                     storage(std::string("history/") + name), stride);
+      };
+      std::cerr << "appending to history: ";
+      std::cerr << "sW, ";   append(sW, "sW");
+      std::cerr << "Sn, ";   append(Sn, "Sn");
+      std::cerr << "Se, ";   append(Se, "Se");
+      std::cerr << "Enr, ";  append(Enr, "Enr");
+      std::cerr << "Pru, ";  append(Pru, "Pru");
+      std::cerr << "Re2W, "; append(Re2W, "Re2W");
+      std::cerr << "Rg2W, "; append(Rg2W, "Rg2W");
+      std::cerr << "Rm2W\n"; append(Rm2W, "Rm2W");
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // fused
+  //////////////////////////////////////////////////////////////////////
+
+  template<typename Weight, size_t D, typename Layout>
+  struct fused {
+    using cell_type = cell<Weight>;
+
+    template<typename T>
+    using array = my_array<T, D, Layout>;
+
+    array<cell_type> cells;
+
+    fused() = default;
+
+    template<typename ExtentList>
+    fused(ExtentList const& extents) : cells(extents) { }
+
+    size_t num_elements() const { return cells.num_elements(); }
+
+    size_t next_row(size_t at, size_t row, size_t m, size_t m_next) const {
+      return cells.next_row(at, row, m, m_next);
+    }
+
+    size_t previous_row(size_t at, size_t row, size_t m, size_t m_next) const {
+      return cells.previous_row(at, row, m, m_next);
+    }
+
+    cell_type& at(size_t i) { return cells.data()[i]; }
+    cell_type const& at(size_t i) const { return cells.data()[i]; }
+
+    template<typename IndexList>
+    size_t offset(IndexList const& indices) const {
+      return cells.offset(indices);
+    }
+
+    template<typename IndexList>
+    cell_type& operator()(IndexList const& indices) {
+      return cells(indices);
+    }
+
+    template<typename Field>
+    auto field(Field) const {
+      using T = std::decay_t<decltype(Field::of(std::declval<cell_type const&>()))>;
+      array<T> result(std::vector<size_t>(cells.shape(), cells.shape() + D));
+      std::transform(cells.begin(), cells.end(), result.begin(),
+                     [](cell_type const& c) { return Field::of(c); });
+      return result;
+    }
+
+    fused& operator+=(fused const& o) {
+      cells += o.cells;
+      return *this;
+    }
+
+    void clear() { cells.fill(cell_type()); }
+
+    // as in the datafile, where weights that are no HDF5 type are long
+    // double (see weights.hpp)
+    using stored_cell =
+      cell<std::conditional_t<std::is_floating_point<Weight>::value,
+                              Weight, long double>>;
+
+    static array<stored_cell> const& stored(array<stored_cell> const& h) {
+      return h;
+    }
+
+    template<typename Cell>
+    static array<stored_cell> stored(array<Cell> const& h) {
+      array<stored_cell> result(std::vector<size_t>(h.shape(), h.shape() + D));
+      std::transform(h.begin(), h.end(), result.begin(),
+                     convert<typename stored_cell::weight_type, Weight>);
+      return result;
+    }
+
+    void load(hdf5::handle const& loc) {
+      if (not hdf5::link_exists(loc, "histograms")) {
+        // written with separate histograms
+        separate<Weight, D, Layout> s(std::vector<size_t>(cells.shape(), cells.shape() + D));
+        s.load(loc);
+        copy(s, *this);
+        return;
+      }
+      std::cerr << "loading histograms\n";
+      auto tmp = stored(cells);
+      hdf5::load(loc, tmp, "histograms");
+      std::transform(tmp.begin(), tmp.end(), cells.begin(),
+                     convert<Weight, typename stored_cell::weight_type>);
+    }
+
+    void save(hdf5::handle const& loc,
+              hdf5::storage_map const& storage = hdf5::storage_map(),
+              dirty_rows const* dirty = nullptr) const {
+      for (auto name : { "sW", "Sn", "Se", "Enr", "Pru", "Re2W", "Rg2W", "Rm2W" })
+        if (hdf5::link_exists(loc, name))
+          hdf5::link_delete(loc, name);
+      std::cerr << "saving histograms\n";
+      hdf5::save(loc, stored(cells), "histograms", storage("histograms"), dirty);
+    }
+
+    void append(hdf5::handle const& history, hdf5::storage_map const& storage,
+                unsigned int stride) const {
+      std::cerr << "appending histograms to history\n";
+      hdf5::append(history, stored(cells), "histograms",
+                   storage("history/histograms"), stride);
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////
+
+  template<typename Weight, size_t D, typename Layout>
+  void separate<Weight, D, Layout>::load(hdf5::handle const& loc)
+  {
+    if (not hdf5::link_exists(loc, "sW") and hdf5::link_exists(loc, "histograms")) {
+      // written with fused histograms
+      fused<Weight, D, Layout> f(std::vector<size_t>(sW.shape(), sW.shape() + D));
+      f.load(loc);
+      copy(f, *this);
+      return;
+    }
+    std::cerr << "loading histograms: ";
+    std::cerr << "sW, ";   hdf5::load(loc, sW, "sW");
+    std::cerr << "Sn, ";   hdf5::load(loc, Sn, "Sn");
+    std::cerr << "Se, ";   hdf5::load(loc, Se, "Se");
+    std::cerr << "Enr, ";  hdf5::load(loc, Enr, "Enr");
+    std::cerr << "Pru, ";  hdf5::load(loc, Pru, "Pru");
+    std::cerr << "Re2W, "; hdf5::load(loc, Re2W, "Re2W");
+    std::cerr << "Rg2W, "; hdf5::load(loc, Rg2W, "Rg2W");
+    std::cerr << "Rm2W\n"; hdf5::load(loc, Rm2W, "Rm2W");
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+
+namespace hdf5 {
+  // the compound type of the fused histograms
+  template<typename Weight>
+  struct datatype_from<histograms::cell<Weight>,
+                       typename std::enable_if<std::is_floating_point<Weight>::value>::type>
+  {
+    static datatype value()
+    {
+      using cell = histograms::cell<Weight>;
+      HDF5_COMPOSITE_DEFINE(cell, (sW)(Se)(Sn)(Enr)(Pru)(Re2W)(Rg2W)(Rm2W))
+      return HDF5_COMPOSITE(cell);
+    }
+  };
+}
+
+#endif // HISTOGRAMS_HPP
+
+// vim: noai:ts=2:sw=2
@@ -0,0 +1,226 @@
+/*
+ * huge_pages.hpp
+ *
+ */
+
+#ifndef HUGE_PAGES_HPP
+#define HUGE_PAGES_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+//
+// Memory for the large arrays (the histograms and the site tables) on huge
+// pages, so that accessing them almost at random misses the TLB less.
+//
+// Allocations of at least page_size bytes are mapped on their own, first
+// asking for explicit huge pages (MAP_HUGETLB, from the pool the system
+// reserved in /proc/sys/vm/nr_hugepages), then for transparent ones
+// (madvise MADV_HUGEPAGE) when the pool is too small. Smaller ones come
+// from operator new as usual.
+//
+// Whether the arrays are allocated this way is chosen at build time, see
+// PAGES in CMakeLists.txt and policy below. report() tells what was
+// obtained, for basic_instance::print_stats.
+//
+namespace huge_pages {
+  static const std::size_t page_size = std::size_t(2) << 20;
+
+  // the bytes mapped so far and still in use, by kind of pages
+  struct counters {
+    std::atomic<std::size_t> explicit_bytes{0};
+    std::atomic<std::size_t> transparent_bytes{0};
+    // mapped, but even madvise failed
+    std::atomic<std::size_t> normal_bytes{0};
+  };
+
+  inline counters& stats()
+  {
+    static counters c;
+    return c;
+  }
+
+  inline std::size_t mapped_size(std::size_t bytes)
+  {
+    return (bytes + page_size - 1) / page_size * page_size;
+  }
+
+#if defined(__linux__)
+  namespace detail {
+    enum kind { explicit_pages, transparent_pages, normal_pages };
+
+    // the kind of pages of each mapping, there are few of them; never
+    // destroyed, arrays with static storage may be freed after it
+    struct registry {
+      std::mutex mutex;
+      std::unordered_map<void*, kind> pages;
+    };
+
+    inline registry& mappings()
+    {
+      static registry* r = new registry;
+      return *r;
+    }
+
+    inline std::atomic<std::size_t>& counter(kind pages)
+    {
+      switch (pages) {
+      case explicit_pages:    return stats().explicit_bytes;
+      case transparent_pages: return stats().transparent_bytes;
+      default:                return stats().normal_bytes;
+      }
+    }
+
+    // bytes rounded to whole huge pages, aligned on one so that the kernel
+    // can back all of them with huge pages
+    inline void* map(std::size_t bytes)
+    {
+      std::size_t const length = mapped_size(bytes);
+      int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB;
+#if defined(MAP_HUGE_SHIFT)
+      flags |= 21 << MAP_HUGE_SHIFT;  // log2(page_size)
+#endif
+      kind pages = explicit_pages;
+      void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+      if (p == MAP_FAILED) {
+        // a huge page more, to align the start by hand
+        void* const base = mmap(nullptr, length + page_size, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+          throw std::bad_alloc();
+        std::size_t const head = -reinterpret_cast<std::uintptr_t>(base) % page_size;
+        p = static_cast<char*>(base) + head;
+        if (head)
+          munmap(base, head);
+        munmap(static_cast<char*>(p) + length, page_size - head);
+        pages = madvise(p, length, MADV_HUGEPAGE) == 0
+          ? transparent_pages : normal_pages;
+      }
+
+      counter(pages) += length;
+      std::lock_guard<std::mutex> lock(mappings().mutex);
+      mappings().pages[p] = pages;
+      return p;
+    }
+
+    inline void unmap(void* p, std::size_t bytes)
+    {
+      std::size_t const length = mapped_size(bytes);
+      {
+        std::lock_guard<std::mutex> lock(mappings().mutex);
+        auto it = mappings().pages.find(p);
+        counter(it->second) -= length;
+        mappings().pages.erase(it);
+      }
+      munmap(p, length);
+    }
+  }
+#endif
+
+  //
+  // A standard allocator mapping the allocations of at least page_size
+  // bytes on huge pages where possible, see above
+  //
+  template<typename T>
+  struct allocator {
+    using value_type = T;
+
+    allocator() = default;
+
+    template<typename U>
+    allocator(allocator<U> const&) { }
+
+    T* allocate(std::size_t n)
+    {
+#if defined(__linux__)
+      if (n * sizeof(T) >= page_size)
+        return static_cast<T*>(detail::map(n * sizeof(T)));
+#endif
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+#if defined(__linux__)
+      if (n * sizeof(T) >= page_size)
+        return detail::unmap(p, n * sizeof(T));
+#endif
+      ::operator delete(p);
+    }
+
+    template<typename U>
+    bool operator==(allocator<U> const&) const { return true; }
+
+    template<typename U>
+    bool operator!=(allocator<U> const&) const { return false; }
+  };
+
+  // the allocator of the large arrays
+#if defined(PAGES_HUGE)
+  template<typename T>
+  using policy = allocator<T>;
+#else
+  template<typename T>
+  using policy = std::allocator<T>;
+#endif
+
+  // how many blocks of some bytes to allocate at once, so that they fill at
+  // least a huge page and the policy maps them: rounded up, fewer would be
+  // too small to be mapped when bytes does not divide page_size
+  inline constexpr std::size_t blocks_per_allocation(std::size_t bytes)
+  {
+#if defined(PAGES_HUGE)
+    return bytes < page_size ? (page_size + bytes - 1) / bytes : 1;
+#else
+    (void) bytes;
+    return 1;
+#endif
+  }
+
+  // the transparent huge pages of the whole process, from the kernel, in
+  // kB, -1 if it does not tell
+  inline long anon_huge_pages_kb()
+  {
+    std::ifstream smaps("/proc/self/smaps_rollup");
+    std::string const key = "AnonHugePages:";
+    std::string line;
+    while (std::getline(smaps, line))
+      if (line.compare(0, key.size(), key) == 0)
+        return std::stol(line.substr(key.size()));
+    return -1;
+  }
+
+  inline void report(std::ostream& out)
+  {
+#if defined(PAGES_HUGE)
+    auto const MB = [](std::size_t bytes) { return bytes >> 20; };
+    out << "huge pages: "
+        << MB(stats().explicit_bytes) << " MB explicit, "
+        << MB(stats().transparent_bytes) << " MB transparent (madvise), "
+        << MB(stats().normal_bytes) << " MB refused";
+    long const kb = anon_huge_pages_kb();
+    if (kb >= 0)
+      out << ", " << kb / 1024 << " MB transparent in use";
+    out << "\n";
+#else
+    (void) out;
+#endif
+  }
+}
+
+#endif // HUGE_PAGES_HPP
+
+// vim: noai:ts=2:sw=2
@@ -14,19 +14,34 @@
 #include "multiplicity.hpp"
 #include "radius.hpp"
 #include "flatperm.hpp"
+#include "histograms.hpp"
+#include "huge_pages.hpp"
+#include "random_engines.hpp"
+#include "weights.hpp"
 
 #include "hdf5_hl.h"
 
 #include <fstream>
 #include <random>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 
 //////////////////////////////////////////////////////////////////////
 //
+// Weight is the arithmetic of the weights and of the histograms summing
+// them, see weights.hpp. The one used by main is chosen at build time, see
+// WEIGHT in CMakeLists.txt and the instance typedef below.
+//
 //////////////////////////////////////////////////////////////////////
 
-struct instance
+template<typename Weight>
+struct basic_instance
 {
-  using lattice = lattices::triangular;
+  using weight_type = Weight;
+
+  using lattice = lattices::packed_triangular;
   using point = lattice::point;
 
   const unsigned int N;
@@ -35,28 +50,57 @@ struct instance
   // this is the random generator that flatperm will use
   // it's instantiated here, passed to the flatperm instance as a reference and
   // (IMPORTANT) seeded from main, i.e. you have to set the seed yourself.
+  // The engine is chosen at build time, see RNG in CMakeLists.txt.
+#if defined(RNG_XOSHIRO256PP)
+  using random_generator_type = engines::xoshiro256pp;
+#elif defined(RNG_PHILOX)
+  using random_generator_type = engines::philox4x32;
+#else
   using random_generator_type = std::mt19937;
+#endif
   random_generator_type rng;
 
   static const int num_flatperm_indices = 2;
-  using flatperm_type = algorithm::flatperm<num_flatperm_indices, random_generator_type>;
+  // a walk of length n has at most n / 2 doubly visited sites, the
+  // histograms only keep those cells, by rows or by tiles as chosen at
+  // build time (see LAYOUT in CMakeLists.txt)
+#if defined(LAYOUT_TILED)
+  using layout = layouts::tiled<num_flatperm_indices>;
+#else
+  using layout = layouts::jagged<num_flatperm_indices>;
+#endif
+  // flatperm keeps Re2W, Rg2W and Rm2W in its cells along with its own
+  // histograms, separate or fused as chosen at build time (see HISTOGRAMS
+  // in CMakeLists.txt)
+#if defined(HISTOGRAMS_FUSED)
+  using histograms_type = histograms::fused<Weight, num_flatperm_indices, layout>;
+#else
+  using histograms_type = histograms::separate<Weight, num_flatperm_indices, layout>;
+#endif
+  using flatperm_type = algorithm::flatperm<num_flatperm_indices, lattice, random_generator_type, Weight, layout, histograms_type>;
   flatperm_type flatperm;
 
-  using walk_type = models::walk<lattice>;
+  using walk_type = models::walk<lattice, sites::grid>;
   walk_type walk;
 
   uint64_t samples;
   features::radius<point> radius;
   features::multiplicity<walk_type> multiplicity;
-  my_array<long double, num_flatperm_indices> Re2W, Rg2W, Rm2W;
 
-  my_array<long double, num_flatperm_indices - 1> sampled_weights;
+  my_array<Weight, num_flatperm_indices - 1> sampled_weights;
   my_array<int, num_flatperm_indices + 1> sampled_walks;
 
+  // the rows of sampled_walks replaced since the last snapshot
+  dirty_rows walks_dirty;
+
   boost::posix_time::ptime start_time;
 
+  // set when the state of rng has been restored from a datafile, which is
+  // then not to be seeded again
+  bool rng_restored = false;
+
   //////////////////////////////////////////////////////////////////////
-  instance(unsigned int N, double mu)
+  basic_instance(unsigned int N, double mu)
     : N(N), mu(mu)
     // initialise flatperm and pass the indices limits
     // of course to accommodate both length 0 and length N, the index must be
@@ -64,74 +108,245 @@ struct instance
     , flatperm({N+1, N/2+1}, mu, rng)
     , walk(N)
     , samples(0)
-    // initialise out histogram with the dimensions as the flatperm histograms
-    , Re2W{flatperm.extents}
-    , Rg2W{flatperm.extents}
-    , Rm2W{flatperm.extents}
     , sampled_weights({flatperm.extents[1]})
     , sampled_walks  ({flatperm.extents[1], flatperm.extents[0], 2})
+    , walks_dirty(flatperm.extents[1])
   {
   }
 
   //
   // This constructor is used to resume a previous simulation
   // It reads some parameters from the datafile, initialises flatperm,
-  // and reload the previous histograms
-  // NOTE: be aware that we are not able to preserve the state of the random
-  // number generator
+  // and reload the previous histograms, the sampled walks and the state of
+  // the random number generator. Datafiles written before the latter was
+  // saved leave rng_restored unset and rng has to be seeded as usual.
   //
-  instance(hdf5::handle loc)
-    : instance( get_attribute(loc, "N") .read<unsigned int>(),
+  basic_instance(hdf5::handle loc)
+    : basic_instance( get_attribute(loc, "N") .read<unsigned int>(),
                 get_attribute(loc, "mu").read<double>() )
   {
     flatperm.load(loc);
-    std::cerr << "loading supplementary histograms: ";
-    std::cerr << "Re2W, "; hdf5::load(loc, Re2W, "Re2W");
-    std::cerr << "Rg2W, "; hdf5::load(loc, Rg2W, "Rg2W");
-    std::cerr << "Rm2W\n"; hdf5::load(loc, Rm2W, "Rm2W");
+    std::cerr << "loading sampled walks: ";
+    std::cerr << "walks, "; hdf5::load(loc, sampled_walks, "sampled_walks");
+    std::cerr << "weights\n"; hdf5::load(loc, sampled_weights, "sampled_weights");
+
+    if (hdf5::attribute_exists(loc, "samples"))
+      samples = get_attribute(loc, "samples").read<unsigned long>();
+
+    if (hdf5::attribute_exists(loc, "rng_state")) {
+      hsize_t dims;
+      H5T_class_t type_class;
+      size_t size;
+      H5LTget_attribute_info(loc.getId(), ".", "rng_state",
+                             &dims, &type_class, &size);
+      std::vector<char> state(size + 1);
+      H5LTget_attribute_string(loc.getId(), ".", "rng_state", state.data());
+
+      std::istringstream in(state.data());
+      in >> rng;
+      rng_restored = not in.fail();
+    }
   }
 
-  void print_stats() const
+  //
+  // Everything save() writes to the datafile, copied at once. A snapshot
+  // taken between two tours (see algorithm::safe_point) or while the
+  // workers of a parallel run are held back (tour_parallel::reduce) can be
+  // saved while sampling goes on.
+  //
+  struct snapshot_type {
+    unsigned int N;
+    double mu;
+    uint64_t tours, samples;
+    random_generator_type rng;
+    typename flatperm_type::snapshot_type flatperm;
+    my_array<Weight, num_flatperm_indices - 1> sampled_weights;
+    my_array<int, num_flatperm_indices + 1> sampled_walks;
+    boost::posix_time::ptime start_time;
+
+    // when the snapshot was taken, UTC
+    boost::posix_time::ptime time;
+
+    // the rows of sampled_walks replaced since the previous snapshot, the
+    // dirty cells of the histograms are in flatperm.dirty
+    dirty_rows walks_dirty;
+
+    void print_stats() const
+    {
+      basic_instance::print_stats(tours, samples, start_time);
+    }
+
+    //
+    // storage gives how each dataset is created by its name, see
+    // hdf5::storage; datasets already in the file keep their own
+    //
+    // incremental only writes what changed since the previous snapshot,
+    // which must have been written to loc (see hdf5::save)
+    //
+    void save(hdf5::handle loc,
+              hdf5::storage_map const& storage = hdf5::storage_map(),
+              bool incremental = false) const
+    {
+      // save preliminary info on the datafile
+      hid_t loc_id = loc.getId();
+
+      H5LTset_attribute_string(loc_id, ".", "TITLE", PACKAGE);
+      H5LTset_attribute_uint  (loc_id, ".", "N", &N, 1);
+      H5LTset_attribute_double(loc_id, ".", "mu", &mu, 1);
+
+      // everything needed to carry on exactly where we stopped
+      unsigned long const samples_ = samples;
+      H5LTset_attribute_ulong (loc_id, ".", "samples", &samples_, 1);
+
+      std::ostringstream rng_state;
+      rng_state << rng;
+      H5LTset_attribute_string(loc_id, ".", "rng_state", rng_state.str().c_str());
+
+      flatperm.save(loc, storage, incremental);
+
+      auto const now = boost::posix_time::second_clock::local_time();
+
+      std::string const time_str = to_simple_string(now);
+      H5LTset_attribute_string(loc.getId(), ".", "time", time_str.c_str());
+
+      std::cerr << "saving sampled walks: ";
+      std::cerr << "walks, "; hdf5::save(loc, sampled_walks, "sampled_walks",
+                                         storage("sampled_walks"),
+                                         incremental ? &walks_dirty : nullptr);
+      std::cerr << "weights\n"; hdf5::save(loc, sampled_weights, "sampled_weights",
+                                           storage("sampled_weights"));
+    }
+
+    //
+    // Append the snapshot to the time series of the group history: its
+    // time (seconds since the epoch), tours and samples, and the
+    // histograms at the lengths n = 0, stride, 2 stride ..., listed in
+    // history/n. The storage of history/sW is storage("history/sW") and
+    // so on (history/histograms when fused), a slice per chunk when not
+    // chunked.
+    //
+    void append(hdf5::handle loc, hdf5::storage_map const& storage,
+                unsigned int stride) const
+    {
+      namespace pt = boost::posix_time;
+
+      auto history = hdf5::group::open_or_create(loc.getId(), "history");
+
+      my_array<unsigned int, 1> n({(N + stride) / stride});
+      for (unsigned int i = 0; i != n.num_elements(); ++i)
+        n[i] = i * stride;
+
+      // the series of a datafile are all at the same lengths, which is
+      // checked before appending anything
+      if (not hdf5::link_exists(history, "n")) {
+        hdf5::save(history, n, "n");
+      } else {
+        bool same = hdf5::dataset::open(history, "n").get_space()
+          .get_simple_extent_npoints() == hssize_t(n.num_elements());
+        if (same) {
+          auto n_file = n;
+          hdf5::load(history, n_file, "n");
+          same = std::equal(n.begin(), n.end(), n_file.begin());
+        }
+        if (not same)
+          throw std::runtime_error("the history of this datafile is at "
+                                   "other lengths");
+      }
+
+      double const seconds =
+        (time - pt::ptime(boost::gregorian::date(1970, 1, 1)))
+        .total_microseconds() / 1e6;
+      hdf5::append_scalar(history, seconds, "time");
+      hdf5::append_scalar(history, tours, "tours");
+      hdf5::append_scalar(history, samples, "samples");
+
+      flatperm.cells.append(history, storage, stride);
+    }
+  };
+
+  //
+  // Copying into the same snapshot again reuses its storage, which is much
+  // faster than allocating new histograms: about 10 ms rather than 50 ms
+  // for N = 1000.
+  //
+  // What has been modified since the previous snapshot moves to s.
+  //
+  void snapshot(snapshot_type& s)
+  {
+    s.N = N;
+    s.mu = mu;
+    s.tours = flatperm.tours();
+    s.samples = samples;
+    s.rng = rng;
+    flatperm.snapshot(s.flatperm);
+    s.sampled_weights = sampled_weights;
+    s.sampled_walks = sampled_walks;
+    s.start_time = start_time;
+    s.time = boost::posix_time::microsec_clock::universal_time();
+    s.walks_dirty = walks_dirty;
+    walks_dirty.clear();
+  }
+
+  static void print_stats(uint64_t tours, uint64_t samples,
+                          boost::posix_time::ptime start_time)
   {
     auto const now = boost::posix_time::second_clock::local_time();
     double seconds = (double) (now - start_time).total_milliseconds()
       / 1000;
 
-    uint64_t tours = flatperm.Sn.data()[0];
-
     std::cerr << "check point at time " << now << "\n"
         << tours << " tours "
         << " (" << (double) tours / seconds << " tours/sec) "
         << samples << " samples"
         << " (" << (double) samples / seconds << " samples/sec)\n";
+    huge_pages::report(std::cerr);
   }
 
-  void save(hdf5::handle loc) const
+  // only when no other thread is running this instance, see snapshot_type
+  void print_stats() const
   {
-    // save preliminary info on the datafile
-    hid_t loc_id = loc.getId();
-
-    H5LTset_attribute_string(loc_id, ".", "TITLE", PACKAGE);
-    H5LTset_attribute_uint  (loc_id, ".", "N", &N, 1);
-    H5LTset_attribute_double(loc_id, ".", "mu", &mu, 1);
-
-    flatperm.save(loc);
-
-    std::cerr << "saving supplementary histograms: ";
-    std::cerr << "Re2W, "; hdf5::save(loc, Re2W, "Re2W");
-    std::cerr << "Rg2W, "; hdf5::save(loc, Rg2W, "Rg2W");
-    std::cerr << "Rm2W, "; hdf5::save(loc, Rm2W, "Rm2W");
+    print_stats(flatperm.tours(), samples, start_time);
+  }
 
-    auto const now = boost::posix_time::second_clock::local_time();
+  void save(hdf5::handle loc)
+  {
+    snapshot_type s;
+    snapshot(s);
+    s.save(loc);
+  }
 
-    std::string const time_str = to_simple_string(now);
-    H5LTset_attribute_string(loc.getId(), ".", "time", time_str.c_str());
+  //
+  // Parallel runs (see algorithm::tour_parallel)
+  //
+  // merge() adds the histograms of a worker to ours and resets them, while
+  // refresh() hands the target weights last published over to a worker.
+  //
+  void merge(basic_instance& worker)
+  {
+    flatperm.merge(worker.flatperm);
+
+    samples += worker.samples;
+    worker.samples = 0;
+
+    auto const walk_size = sampled_walks.shape()[1] * sampled_walks.shape()[2];
+    for (unsigned int m = 0; m != flatperm.extents[1]; ++m) {
+      Weight const W = worker.sampled_weights.data()[m];
+      if (W > sampled_weights.data()[m]) {
+        sampled_weights.data()[m] = W;
+        std::copy_n(worker.sampled_walks.data() + m * walk_size, walk_size,
+                    sampled_walks.data() + m * walk_size);
+        walks_dirty.mark_row(m, 0, flatperm.extents[0]);
+      }
+    }
+    worker.sampled_weights.fill(0);
+  }
 
-    std::cerr << "walks, "; hdf5::save(loc, sampled_walks, "sampled_walks");
-    std::cerr << "weights\n"; hdf5::save(loc, sampled_weights, "sampled_weights");
+  void refresh(std::shared_ptr<typename flatperm_type::estimates const> const& e)
+  {
+    flatperm.refresh(e);
   }
 
-  std::vector<point> atmosphere() const
+  walk_type::atmosphere_type atmosphere() const
   {
     return walk.atmosphere();
   }
@@ -144,16 +359,11 @@ struct instance
   // counters and/or observables, and update the flatperm indices.
   // This function can also correct the weight of the sample.
   //
-  void register_step(point const& x, long double& W)
+  void register_step(point const& x, Weight& W)
   {
     samples ++;
 
-    walk.register_step(x);
-    radius.register_step(walk);
-    multiplicity.register_step(walk);
-
-    flatperm.indices[0] = walk.size();
-    flatperm.indices[1] = multiplicity.get<2>();
+    advance(x);
 
     auto const n = walk.size();
 
@@ -163,17 +373,21 @@ struct instance
     long double const C = radius.get_norm_square_sum();
 
     long double const Re2 = A;
-    long double const Rg2 = C / n - B / n / n;
+    // rounding can leave it slightly negative, which a log_weight cannot
+    // represent
+    long double const Rg2 = std::max<long double>(C / n - B / n / n, 0);
     long double const Rm2 = C / n;
 
-    Re2W(flatperm.indices) += W * Re2;
-    Rg2W(flatperm.indices) += W * Rg2;
-    Rm2W(flatperm.indices) += W * Rm2;
+    auto&& cell = flatperm.cells.at(flatperm.offset);
+    cell.Re2W += W * Re2;
+    cell.Rg2W += W * Rg2;
+    cell.Rm2W += W * Rm2;
 
     if (n == N) {
       auto m = flatperm.indices[1];
       if (W > sampled_weights[m]) {
         sampled_weights[m] = W;
+        walks_dirty.mark_row(m, 0, N + 1);
         int i = 0;
         for(auto const& xy : walk) {
           sampled_walks[m][i][0] = xy[0];
@@ -184,22 +398,66 @@ struct instance
     }
   }
 
+  //
+  // Add a step to the walk and its features without sampling it. flatperm
+  // uses this to rebuild the walk leading to a stolen branch.
+  //
+  void advance(point const& x)
+  {
+    walk.register_step(x);
+    radius.register_step(walk);
+    multiplicity.register_step(walk);
+
+    // the walk is one step longer, the cell a row further
+    auto const n = walk.size();
+    auto const m = multiplicity.get<2>();
+    flatperm.offset = flatperm.cells.next_row(flatperm.offset, n - 1,
+                                              flatperm.indices[1], m);
+    flatperm.indices[0] = n;
+    flatperm.indices[1] = m;
+    assert(flatperm.offset == flatperm.cells.offset(flatperm.indices));
+
+    flatperm.live->site_table(walk.sites().size());
+  }
+
   void unregister_step()
   {
     multiplicity.unregister_step(walk);
     radius.unregister_step(walk);
     walk.unregister_step();
 
-    flatperm.indices[0] = walk.size();
-    flatperm.indices[1] = multiplicity.get<2>();
+    // as in advance(), the other way
+    auto const n = walk.size();
+    auto const m = multiplicity.get<2>();
+    flatperm.offset = flatperm.cells.previous_row(flatperm.offset, n + 1,
+                                                  flatperm.indices[1], m);
+    flatperm.indices[0] = n;
+    flatperm.indices[1] = m;
+    assert(flatperm.offset == flatperm.cells.offset(flatperm.indices));
   }
 
   void run(unsigned int S) {
     start_time = boost::posix_time::second_clock::local_time();
     return flatperm.run(this, S);
   }
+
+  template<typename SafePoint>
+  void run(unsigned int S, SafePoint&& safe_point) {
+    start_time = boost::posix_time::second_clock::local_time();
+    return flatperm.run(this, S, std::forward<SafePoint>(safe_point));
+  }
 };
 
+#if defined(WEIGHT_DOUBLE)
+using instance = basic_instance<double>;
+#elif defined(WEIGHT_DOUBLE_DOUBLE)
+using instance = basic_instance<weights::double_double>;
+#elif defined(WEIGHT_LOG)
+using instance = basic_instance<weights::log_weight>;
+#else
+using instance = basic_instance<long double>;
+#endif
+
 #endif
 
 /* vim: set et fenc=utf-8 ff=unix sts=0 sw=2 ts=2 : */
@@ -8,7 +8,10 @@
 
 #include <algorithm>
 #include <array>
+#include <cstdint>
+#include <functional>
 #include <numeric>
+#include <ostream>
 #include <vector>
 
 namespace lattices {
@@ -140,11 +143,121 @@ namespace lattices {
       }
     };
 
-    static std::vector<point> get_neighbours(point const& c)
+    static std::array<point, coordination> get_neighbours(point const& c)
     {
-      return { c + point{1,0}, c + point{-1,0},
+      return {{ c + point{1,0}, c + point{-1,0},
         c + point{0,1}, c + point{0,-1},
-        c + point{1,1}, c + point{-1,-1} };
+        c + point{1,1}, c + point{-1,-1} }};
+    }
+
+    static const point origin() { return point{0, 0}; };
+  };
+
+  //////////////////////////////////////////////////////////////////////
+
+  //
+  // A point of Z^2 packed in a single 64 bits word: each coordinate is
+  // biased by 2^31 and takes 32 bits, x in the high half and y in the low
+  // half. As long as the biased coordinates stay in range (walks shorter
+  // than 2^31 steps) sums and differences can be done on the whole word,
+  // with the bias taken care of by adding or subtracting it once.
+  //
+  struct packed_point {
+    static const std::uint64_t bias = std::uint64_t(1) << 31;
+    static const std::uint64_t zero = (bias << 32) | bias;
+
+    std::uint64_t word;
+
+    template<typename U>
+    struct rebind { typedef point<2, U> result_type; };
+
+    constexpr packed_point() : word(zero) { }
+    constexpr packed_point(std::int64_t x, std::int64_t y)
+      : word(((std::uint64_t(x) + bias) << 32) + std::uint64_t(y) + bias) { }
+
+    static constexpr packed_point from_word(std::uint64_t w) {
+      return packed_point(w, raw_word());
+    }
+
+    // an offset is a point without the bias, adding it to a packed point
+    // moves it by (x, y)
+    static constexpr std::uint64_t offset(std::int64_t x, std::int64_t y) {
+      return (std::uint64_t(x) << 32) + std::uint64_t(y);
+    }
+
+    int operator[](std::size_t i) const {
+      return i == 0
+        ? int(std::int64_t(word >> 32) - std::int64_t(bias))
+        : int(std::int64_t(word & 0xffffffffu) - std::int64_t(bias));
+    }
+
+    template<typename T>
+    operator point<2, T>() const {
+      return point<2, T>{ T((*this)[0]), T((*this)[1]) };
+    }
+
+    packed_point& operator+=(packed_point const& rhs) {
+      word += rhs.word - zero;
+      return *this;
+    }
+
+    packed_point& operator-=(packed_point const& rhs) {
+      word -= rhs.word - zero;
+      return *this;
+    }
+
+    packed_point operator+(packed_point const& rhs) const {
+      return from_word(word + (rhs.word - zero));
+    }
+
+    packed_point operator-(packed_point const& rhs) const {
+      return from_word(word - (rhs.word - zero));
+    }
+
+    packed_point operator+(std::uint64_t offset) const {
+      return from_word(word + offset);
+    }
+
+    bool operator==(packed_point const& rhs) const { return word == rhs.word; }
+    bool operator!=(packed_point const& rhs) const { return word != rhs.word; }
+
+  private:
+    struct raw_word { };
+    constexpr packed_point(std::uint64_t w, raw_word) : word(w) { }
+  };
+
+  inline std::ostream& operator<<(std::ostream& o, packed_point const& p) {
+    return o << p[0] << " " << p[1];
+  }
+
+  inline std::int64_t norm_square(packed_point const& p) {
+    std::int64_t const x = p[0], y = p[1];
+    return x * x + y * y;
+  }
+
+  //
+  // The triangular lattice again, on packed points.
+  //
+  struct packed_triangular {
+    static const unsigned int dimensionality = 2;
+    static const unsigned int coordination = 6;
+
+    using point = packed_point;
+
+    // the golden ratio multiplier spreads the y half into the high bits and
+    // the final shift folds them back on the ones the tables look at
+    struct hash {
+      std::size_t operator()(point const& p) const {
+        std::uint64_t const h = p.word * 0x9e3779b97f4a7c15ull;
+        return h ^ (h >> 32);
+      }
+    };
+
+    static std::array<point, coordination> get_neighbours(point const& c)
+    {
+      return {{ c + point::offset(1,0), c + point::offset(-1,0),
+        c + point::offset(0,1), c + point::offset(0,-1),
+        c + point::offset(1,1), c + point::offset(-1,-1) }};
     }
 
     static const point origin() { return point{0, 0}; };
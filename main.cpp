@@ -4,6 +4,10 @@
  */
 
 #include "instance.hpp"
+#include "metrics.hpp"
+#include "parallel.hpp"
+#include "safe_point.hpp"
+#include "snapshot_writer.hpp"
 
 #include "hdf5pp/hdf5.hpp"
 
@@ -16,7 +20,18 @@
 #include <boost/program_options.hpp>
 #include <boost/thread.hpp>
 
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
 #include <csignal>
+#include <cstdio>
+#include <functional>
+#include <memory>
 #include <string>
 #include <stdexcept>
 
@@ -61,6 +76,101 @@ struct handlers {
   }
 };
 
+//////////////////////////////////////////////////////////////////////
+// --benchmark: a run without data file nor checkpoints, reporting its
+// throughput and a hash of the flatperm histograms so that two builds can
+// be checked to produce bit-identical results
+//////////////////////////////////////////////////////////////////////
+
+namespace {
+  // 64 bits FNV-1a
+  struct histogram_hash {
+    uint64_t h = 14695981039346656037ull;
+
+    void add_bytes(uint64_t x) {
+      for (int i = 0; i != 8; ++i) {
+        h ^= (x >> (8 * i)) & 0xff;
+        h *= 1099511628211ull;
+      }
+    }
+
+    void add(uint64_t x) { add_bytes(x); }
+
+    // the exact value, regardless of the padding of long double: all the
+    // bits of the mantissa, then the sign and the exponent
+    void add(long double x) {
+      int e = 0;
+      uint64_t m = 0;
+      // neither inf nor NaN converts to an integer
+      if (std::isfinite(x))
+        m = uint64_t(std::ldexp(std::fabs(std::frexp(x, &e)), 64));
+      else
+        e = std::isnan(x) ? INT_MAX : INT_MAX - 1;
+      add_bytes(m);
+      add_bytes(uint64_t(std::signbit(x)) << 32 | uint32_t(e));
+    }
+
+    // any other weight type, through its value as a long double
+    template<typename Weight>
+    void add(Weight const& x) { add(static_cast<long double>(x)); }
+  };
+
+  // over all the cells of the datafile, those a jagged array does not
+  // keep being zero, whatever the layout
+  template<typename T, size_t D, typename Layout>
+  uint64_t hash(my_array<T, D, Layout> const& a)
+  {
+    static_assert(D == 2, "the histograms have two indices");
+
+    histogram_hash h;
+    std::array<size_t, 2> i;
+    for (i[0] = 0; i[0] != a.shape()[0]; ++i[0])
+      for (i[1] = 0; i[1] != a.shape()[1]; ++i[1])
+        h.add(i[1] < a.row_extent(i[0]) ? a.at(a.offset(i)) : T());
+    return h.h;
+  }
+
+  int benchmark(unsigned int N, unsigned int S, unsigned int seed,
+                unsigned int threads, double mu)
+  {
+    instance my_instance(N, mu);
+    my_instance.rng.seed(seed);
+
+    std::unique_ptr<algorithm::tour_parallel<instance>> team;
+    if (threads > 1)
+      team.reset(new algorithm::tour_parallel<instance>(my_instance, threads));
+
+    auto const start = std::chrono::steady_clock::now();
+    if (team)
+      team->run(S);
+    else
+      my_instance.run(S);
+    std::chrono::duration<double> const elapsed =
+      std::chrono::steady_clock::now() - start;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    auto const& fp = my_instance.flatperm;
+    double const seconds = elapsed.count();
+
+    std::printf("N %u tours %u seed %u threads %u mu %g\n",
+                N, S, seed, threads, mu);
+    std::printf("time %.3f s\n", seconds);
+    std::printf("tours/sec %.3f\n", fp.tours() / seconds);
+    std::printf("samples/sec %.1f\n", my_instance.samples / seconds);
+    std::printf("peak RSS %ld kB\n", usage.ru_maxrss);
+    namespace fields = histograms::fields;
+    auto field = [&](auto f) { return hash(fp.cells.field(f)); };
+    std::printf("hash sW  %016llx\n", (unsigned long long) field(fields::sW()));
+    std::printf("hash Sn  %016llx\n", (unsigned long long) field(fields::Sn()));
+    std::printf("hash Se  %016llx\n", (unsigned long long) field(fields::Se()));
+    std::printf("hash Enr %016llx\n", (unsigned long long) field(fields::Enr()));
+    std::printf("hash Pru %016llx\n", (unsigned long long) field(fields::Pru()));
+    return 0;
+  }
+}
+
 int main(int argc, char* argv[])
 {
   std::cerr << "this is " << PACKAGE << "\n";
@@ -74,8 +184,12 @@ int main(int argc, char* argv[])
 
     ("resume", "resume")
 
-    ("filename",        po::value<std::string>()->required(),
-     "filename (required)")
+    ("benchmark",
+     "run without data file nor checkpoints and report the throughput "
+     "and a hash of the histograms (default -N 1000 -S 100)")
+
+    ("filename",        po::value<std::string>(),
+     "filename (required unless benchmarking)")
 
     ("tours,S",         po::value<unsigned int>(),
      "tours")
@@ -83,6 +197,42 @@ int main(int argc, char* argv[])
     ("seed",            po::value<unsigned int>(),
      "random generator seed")
 
+    ("node",            po::value<unsigned int>()->default_value(0),
+     "number of this process among those sharing a seed, they draw "
+     "independent streams (counter-based random generators only)")
+
+    ("threads",         po::value<unsigned int>()->default_value(1),
+     "number of worker threads running tours in parallel")
+
+    ("snapshots",       po::value<unsigned int>()->default_value(2),
+     "maximum number of checkpoints being written or waiting to be at a "
+     "time, each holds a copy of all the histograms; with 1, a checkpoint "
+     "asked for during a write is only taken once the write is over")
+
+    ("stop-timeout",    po::value<double>()->default_value(20),
+     "seconds to wait for the current tour when asked to stop, before "
+     "interrupting it and saving the histograms as they are")
+
+    ("compress",        po::value<unsigned int>()->default_value(0),
+     "deflate level (1-9) of the datasets, with shuffling, 0 to store "
+     "them uncompressed; datasets already in the file keep their own")
+
+    ("incremental",
+     "checkpoints after the first one only write the parts of the "
+     "histograms changed since the previous one, for slow file systems")
+
+    ("history",         po::value<unsigned int>()->default_value(0),
+     "also append every checkpoint to time series in the group history, "
+     "keeping the histograms at lengths 0, k, 2k ... for k the value given "
+     "(0 for none)")
+
+    ("metrics",         po::value<std::string>(),
+     "file to rewrite with the progress of the run in the Prometheus text "
+     "format, e.g. for the textfile collector of node_exporter")
+
+    ("metrics-interval", po::value<double>()->default_value(15),
+     "seconds between two updates of the metrics file")
+
     ("length,N",        po::value<unsigned int>(),
      "walk maximum length (ignored when resuming)")
 
@@ -104,6 +254,18 @@ int main(int argc, char* argv[])
     return 0;
   }
 
+  if (vm.count("benchmark"))
+    return benchmark(vm.count("length") ? vm["length"].as<unsigned int>() : 1000,
+                     vm.count("tours")  ? vm["tours"].as<unsigned int>()  : 100,
+                     vm.count("seed")   ? vm["seed"].as<unsigned int>()   : 1,
+                     vm["threads"].as<unsigned int>(),
+                     vm["mu"].as<double>());
+
+  if (not vm.count("filename")) {
+    std::cerr << desc << "\n";
+    return 0;
+  }
+
   const std::string filename = vm["filename"].as<std::string>();
   const unsigned int S = vm["tours"].as<unsigned int>();
 
@@ -121,41 +283,169 @@ int main(int argc, char* argv[])
     ;
 
   //
-  // default seed is 1
+  // default seed is 1, a resumed run carries on with the random generator
+  // where it stopped unless a seed is given explicitly
   //
-  unsigned int seed = vm.count("seed")
-    ? vm["seed"].as<unsigned int>()
-    : 1
-    ;
+  // a counter-based generator is keyed by both the seed and the node, the
+  // streams of different nodes never overlap
+  //
+  unsigned int const node = vm["node"].as<unsigned int>();
+  if (node != 0 and not engines::is_counter_based<instance::random_generator_type>::value) {
+    std::cerr << "--node requires a counter-based random generator (RNG=philox)\n";
+    return 1;
+  }
 
-  std::cerr << "seed set to " << seed << "\n";
-  my_instance.rng.seed(seed);
+  if (my_instance.rng_restored and not vm.count("seed")) {
+    std::cerr << "random generator state restored\n";
+  } else {
+    unsigned int seed = vm.count("seed")
+      ? vm["seed"].as<unsigned int>()
+      : 1
+      ;
+
+    std::cerr << "seed set to " << seed << " on node " << node << "\n";
+    my_instance.rng.seed(uint64_t(node) << 32 | seed);
+  }
+
+  //
+  // with more than one thread, workers are seeded from my_instance.rng
+  //
+  unsigned int const threads = vm["threads"].as<unsigned int>();
+
+  std::unique_ptr<algorithm::tour_parallel<instance>> team;
+  if (threads > 1)
+    team.reset(new algorithm::tour_parallel<instance>(my_instance, threads));
 
   //////////////////////////////////////////////////////////////////////
 
   boost::asio::io_service io_service;
 
+  //
+  // checkpoints save a snapshot taken between two tours, or while the
+  // workers are held back, and the sampler carries on meanwhile; the
+  // datafile is only written by the writer thread
+  //
+  algorithm::safe_point<instance> safe_point(my_instance);
+
+  unsigned int const compress = vm["compress"].as<unsigned int>();
+  hdf5::storage_map const storage(compress
+                                  ? hdf5::storage::compressed(std::min(compress, 9u))
+                                  : hdf5::storage());
+
+  //
+  // with --incremental, the first checkpoint writes everything and the
+  // next ones only what changed since the previous one, unless that one
+  // failed
+  //
+  bool const incremental_wanted = vm.count("incremental");
+  bool incremental = false;
+
+  unsigned int const history = vm["history"].as<unsigned int>();
+
+  algorithm::snapshot_writer<instance::snapshot_type> writer(
+    [&](instance::snapshot_type const& snapshot) {
+      bool const only_changes = incremental;
+      incremental = false;
+      snapshot.save(hfile, storage, only_changes);
+      if (history)
+        snapshot.append(hfile, storage, history);
+      hfile.flush();
+      incremental = incremental_wanted;
+      snapshot.print_stats();
+    },
+    vm["snapshots"].as<unsigned int>());
+
   auto save_data = [&] {
-    my_instance.save(hfile);
-    hfile.flush();
-    my_instance.print_stats();
+    writer.submit([&](instance::snapshot_type& snapshot) {
+        if (team)
+          team->reduce([&] { my_instance.snapshot(snapshot); });
+        else
+          safe_point.take(snapshot);
+      });
   };
 
-  handlers my_handlers{io_service, save_data};
+  //
+  // checkpoints are taken on a thread of their own, which may wait for the
+  // end of a tour or for a free snapshot buffer, so that the signals are
+  // still handled meanwhile; those asked for while one is pending are
+  // merged into it
+  //
+  boost::asio::io_service checkpoints;
+  std::unique_ptr<boost::asio::io_service::work> checkpoints_work(
+      new boost::asio::io_service::work(checkpoints));
+  boost::thread checkpoint_thread([&] { checkpoints.run(); });
+  std::atomic<bool> checkpoint_pending(false);
+
+  handlers my_handlers{io_service, [&] {
+      if (not checkpoint_pending.exchange(true))
+        checkpoints.post([&] {
+            checkpoint_pending = false;
+            save_data();
+          });
+    }};
+
+  //
+  // the metrics are read from the live counters of the sampler, without
+  // snapshots, so that they keep moving between checkpoints and show a
+  // run stuck in a tour; the series of a job are told apart by its
+  // datafile and pid
+  //
+  std::unique_ptr<metrics::textfile> exporter;
+  if (vm.count("metrics"))
+    exporter.reset(new metrics::textfile(
+        vm["metrics"].as<std::string>(),
+        vm["metrics-interval"].as<double>(),
+        [&] {
+          std::vector<metrics::live const*> lives;
+          if (team)
+            for (unsigned int k = 0; k != team->size(); ++k)
+              lives.push_back(team->worker(k).flatperm.live.get());
+          else
+            lives.push_back(my_instance.flatperm.live.get());
+          return lives;
+        },
+        metrics::label("datafile", filename) + ","
+        + metrics::label("pid", std::to_string(getpid()))));
 
   //////////////////////////////////////////////////
   boost::thread t([&] {
     try {
-      my_instance.run(S);
-      io_service.stop();
+      if (team)
+        team->run(S);
+      else
+        my_instance.run(S, std::ref(safe_point));
     } catch (boost::thread_interrupted e) {
       std::cerr << "interrupted!\n";
     }
+    safe_point.close();
+    io_service.stop();
     });
 
   io_service.run();
   std::cerr << "main thread ready to stop.\n";
-  t.interrupt();
+
+  // a serial run stops after its current tour, so that the last checkpoint
+  // is a consistent one too, unless that takes longer than stop-timeout: a
+  // tour of a long walk may outlast the time the scheduler leaves before
+  // killing the job. The workers of a parallel run are interrupted and
+  // merge what they have sampled so far.
+  if (team)
+    t.interrupt();
+  else {
+    safe_point.stop();
+    auto const timeout = pt::milliseconds(long(1000 * vm["stop-timeout"].as<double>()));
+    if (not t.timed_join(timeout)) {
+      std::cerr << "the tour is not over, interrupting it\n";
+      t.interrupt();
+    }
+  }
   t.join();
+
+  // a checkpoint still waiting for the sampler has been released by now
+  checkpoints_work.reset();
+  checkpoints.stop();
+  checkpoint_thread.join();
+
   save_data();
+  writer.close();
 }
@@ -0,0 +1,312 @@
+/*
+ * metrics.hpp
+ *
+ */
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace metrics {
+  //
+  // Counters of a flatperm run which other threads can read while it goes
+  // on. Only the thread running the tours writes them, with plain relaxed
+  // loads and stores, so that keeping them up to date costs next to
+  // nothing; readers may see values a few steps old.
+  //
+  // The counters only cover what this process sampled, unlike the
+  // histograms which include the tours of the runs it resumes.
+  //
+  struct live {
+    std::atomic<uint64_t> tour;
+    std::atomic<unsigned int> depth;     // length of the current walk
+    std::atomic<unsigned int> history;   // pending enrichment marks
+    std::atomic<std::size_t> sites;      // cells of the site table
+
+    // by walk length, summed over the other flatperm indices
+    std::vector<std::atomic<uint64_t>> samples, enrichments, prunings;
+
+    explicit live(std::size_t lengths)
+      : tour(0), depth(0), history(0), sites(0)
+      , samples(lengths), enrichments(lengths), prunings(lengths)
+    { }
+
+    void started(uint64_t S)
+    {
+      set(tour, S);
+      add(samples[0], 1);
+    }
+
+    void sampled(unsigned int n, std::size_t marks)
+    {
+      set(depth, n);
+      set(history, marks);
+      add(samples[n], 1);
+    }
+
+    void site_table(std::size_t cells) { set(sites, cells); }
+
+    void enriched(unsigned int n, uint64_t copies) { add(enrichments[n], copies); }
+    void pruned(unsigned int n) { add(prunings[n], 1); }
+
+    template<typename T>
+    static T get(std::atomic<T> const& c)
+    {
+      return c.load(std::memory_order_relaxed);
+    }
+
+    template<typename T, typename U>
+    static void set(std::atomic<T>& c, U value)
+    {
+      c.store(value, std::memory_order_relaxed);
+    }
+
+  private:
+    // not a read-modify-write, there is a single writer
+    static void add(std::atomic<uint64_t>& c, uint64_t k)
+    {
+      c.store(c.load(std::memory_order_relaxed) + k, std::memory_order_relaxed);
+    }
+  };
+
+  // a label for the Prometheus text format, name="value" with value escaped
+  inline std::string label(std::string const& name, std::string const& value)
+  {
+    std::string result = name + "=\"";
+    for (char c : value) {
+      if (c == '\\' or c == '"')
+        result += '\\';
+      if (c == '\n')
+        result += "\\n";
+      else
+        result += c;
+    }
+    return result + "\"";
+  }
+
+  // current resident set size
+  inline std::size_t resident_bytes()
+  {
+    long pages = 0, resident = 0;
+    if (std::FILE* f = std::fopen("/proc/self/statm", "r")) {
+      if (std::fscanf(f, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+      std::fclose(f);
+    }
+    return std::size_t(resident) * sysconf(_SC_PAGESIZE);
+  }
+
+  inline std::size_t peak_resident_bytes()
+  {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return std::size_t(usage.ru_maxrss) * 1024;
+  }
+
+  //////////////////////////////////////////////////////////////////////
+
+  //
+  // Rewrites a file in the Prometheus text format every interval, from a
+  // thread of its own, with the counters of the live structs that sources
+  // returns (one per worker). The file is written aside and renamed, so
+  // that a reader (e.g. the textfile collector of node_exporter) never
+  // sees half of it.
+  //
+  // Every series carries the labels given, which should tell the jobs of
+  // a host apart. A job is stuck when its samples stop growing, and its
+  // file is stale when visaw_last_update_seconds stops moving. Per length
+  // counters are summed over about length_bins ranges of lengths.
+  //
+  class textfile {
+    std::string const path;
+    boost::posix_time::time_duration const interval;
+    std::function<std::vector<live const*>()> const sources;
+    std::string const labels;
+
+    static const unsigned int length_bins = 20;
+
+    boost::posix_time::ptime const start;
+    boost::posix_time::ptime last_time;
+    uint64_t last_tours, last_samples;
+
+    boost::thread thread;
+
+  public:
+    textfile(std::string const& path, double seconds,
+             std::function<std::vector<live const*>()> sources,
+             std::string const& labels)
+      : path(path)
+      , interval(boost::posix_time::milliseconds(long(seconds * 1000)))
+      , sources(sources)
+      , labels(labels)
+      , start(boost::posix_time::microsec_clock::universal_time())
+      , last_time(start)
+      , last_tours(0)
+      , last_samples(0)
+      , thread([this] { run(); })
+    {
+    }
+
+    ~textfile()
+    {
+      thread.interrupt();
+      thread.join();
+    }
+
+  private:
+    void run()
+    {
+      try {
+        while (true) {
+          write();
+          boost::this_thread::sleep(interval);
+        }
+      } catch (boost::thread_interrupted const&) {
+        write();
+      }
+    }
+
+    static double seconds_since_epoch(boost::posix_time::ptime t)
+    {
+      using namespace boost::posix_time;
+      return (t - ptime(boost::gregorian::date(1970, 1, 1)))
+        .total_microseconds() / 1e6;
+    }
+
+    void write()
+    {
+      namespace pt = boost::posix_time;
+
+      auto const workers = sources();
+      auto const now = pt::microsec_clock::universal_time();
+
+      std::size_t const lengths = workers.empty() ? 0 : workers[0]->samples.size();
+      std::size_t const bin = std::max<std::size_t>(1, (lengths + length_bins - 1) / length_bins);
+
+      uint64_t tours = 0, samples = 0;
+      std::vector<uint64_t> S(lengths), E(lengths), P(lengths);
+      for (auto w : workers)
+        for (std::size_t n = 0; n != lengths; ++n) {
+          S[n] += live::get(w->samples[n]);
+          E[n] += live::get(w->enrichments[n]);
+          P[n] += live::get(w->prunings[n]);
+        }
+      if (lengths)
+        tours = S[0];
+      for (auto x : S)
+        samples += x;
+
+      double const dt = (now - last_time).total_microseconds() / 1e6;
+
+      std::ostringstream o;
+      auto const L = "{" + labels + "}";
+      auto with = [&](std::string const& more) {
+        return "{" + labels + (labels.empty() ? "" : ",") + more + "}";
+      };
+      auto metric = [&](char const* name, char const* type, char const* help) {
+        o << "# HELP " << name << " " << help << "\n"
+          << "# TYPE " << name << " " << type << "\n";
+      };
+
+      metric("visaw_last_update_seconds", "gauge", "Time of this update.");
+      o << "visaw_last_update_seconds" << L << " " << std::fixed
+        << seconds_since_epoch(now) << "\n" << std::defaultfloat;
+
+      metric("visaw_start_time_seconds", "gauge", "Time the process started sampling.");
+      o << "visaw_start_time_seconds" << L << " " << std::fixed
+        << seconds_since_epoch(start) << "\n" << std::defaultfloat;
+
+      metric("visaw_tours_total", "counter", "Tours started by this process.");
+      o << "visaw_tours_total" << L << " " << tours << "\n";
+
+      metric("visaw_samples_total", "counter", "Samples taken by this process.");
+      o << "visaw_samples_total" << L << " " << samples << "\n";
+
+      metric("visaw_tours_per_second", "gauge", "Tours started per second since the previous update.");
+      o << "visaw_tours_per_second" << L << " "
+        << (dt > 0 ? (tours - last_tours) / dt : 0) << "\n";
+
+      metric("visaw_samples_per_second", "gauge", "Samples per second since the previous update.");
+      o << "visaw_samples_per_second" << L << " "
+        << (dt > 0 ? (samples - last_samples) / dt : 0) << "\n";
+
+      metric("visaw_tour", "gauge", "Number of the tour being run.");
+      for (std::size_t k = 0; k != workers.size(); ++k)
+        o << "visaw_tour" << with("worker=\"" + std::to_string(k) + "\"") << " "
+          << live::get(workers[k]->tour) << "\n";
+
+      metric("visaw_walk_length", "gauge", "Length of the walk being grown.");
+      for (std::size_t k = 0; k != workers.size(); ++k)
+        o << "visaw_walk_length" << with("worker=\"" + std::to_string(k) + "\"") << " "
+          << live::get(workers[k]->depth) << "\n";
+
+      metric("visaw_history_marks", "gauge", "Pending enrichments in the history of the tour.");
+      for (std::size_t k = 0; k != workers.size(); ++k)
+        o << "visaw_history_marks" << with("worker=\"" + std::to_string(k) + "\"") << " "
+          << live::get(workers[k]->history) << "\n";
+
+      metric("visaw_site_table_cells", "gauge", "Cells allocated in the site table of the walk.");
+      for (std::size_t k = 0; k != workers.size(); ++k)
+        o << "visaw_site_table_cells" << with("worker=\"" + std::to_string(k) + "\"") << " "
+          << live::get(workers[k]->sites) << "\n";
+
+      // per range of lengths [n, n + bin)
+      auto per_length = [&](char const* name, char const* help,
+                            std::vector<uint64_t> const& h) {
+        metric(name, "counter", help);
+        for (std::size_t n = 0; n < lengths; n += bin) {
+          uint64_t sum = 0;
+          for (std::size_t i = n; i != std::min(n + bin, lengths); ++i)
+            sum += h[i];
+          o << name << with("lengths=\"" + std::to_string(n) + "-"
+                            + std::to_string(std::min(n + bin, lengths) - 1) + "\"")
+            << " " << sum << "\n";
+        }
+      };
+      per_length("visaw_length_samples_total", "Samples by range of walk lengths.", S);
+      per_length("visaw_length_enrichments_total", "Enrichment copies (Enr) by range of walk lengths.", E);
+      per_length("visaw_length_prunings_total", "Prunings (Pru) by range of walk lengths.", P);
+
+      metric("visaw_resident_bytes", "gauge", "Resident set size.");
+      o << "visaw_resident_bytes" << L << " " << resident_bytes() << "\n";
+
+      metric("visaw_peak_resident_bytes", "gauge", "Peak resident set size.");
+      o << "visaw_peak_resident_bytes" << L << " " << peak_resident_bytes() << "\n";
+
+      last_time = now;
+      last_tours = tours;
+      last_samples = samples;
+
+      std::string const tmp = path + ".tmp";
+      {
+        std::ofstream f(tmp);
+        f << o.str();
+        if (not f) {
+          std::cerr << "cannot write metrics to " << tmp << "\n";
+          return;
+        }
+      }
+      if (std::rename(tmp.c_str(), path.c_str()) != 0)
+        std::cerr << "cannot rename metrics file " << tmp << "\n";
+    }
+  };
+}
+
+#endif // METRICS_HPP
+
+// vim: noai:ts=2:sw=2
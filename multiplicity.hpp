@@ -8,7 +8,7 @@
 
 #include <array>
 #include <cassert>
-#include <unordered_set>
+#include <ostream>
 
 namespace features {
   template<class Walk>
@@ -16,34 +16,30 @@ namespace features {
     using lattice_type = typename Walk::lattice_type;
     using point = typename lattice_type::point;
 
-    std::unordered_multiset<point, typename lattice_type::hash> _points;
-
     // this should depend on coordination
     std::array<unsigned int, lattice_type::coordination/2+1> _m;
 
   public:
-    multiplicity() {
+    // the visits to each site are counted by the walk itself
+    multiplicity()
+    {
       _m.fill(0);
     }
 
+    // to be called after the walk registered its step
     void register_step(Walk const& walk) {
-      _points.insert(walk.back());
-      int k = _points.count(walk.back());
+      int k = walk.visits();
       assert(k > 0);
       _m[k-1] --;
       _m[k] ++;
     }
 
+    // to be called before the walk unregisters its step
     void unregister_step(Walk const& walk) {
-      auto it = _points.find(walk.back());
-      assert(it != _points.end());
-
-      int k = _points.count(walk.back());
+      int k = walk.visits();
       assert(k > 0);
       _m[k] --;
       _m[k-1] ++;
-
-      _points.erase(it);
     }
 
     template<unsigned int I>
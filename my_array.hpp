@@ -2,27 +2,262 @@
 #define MY_ARRAY_HPP
 
 #include "hdf5pp/hdf5.hpp"
+#include "huge_pages.hpp"
 
 #include <algorithm>
+#include <array>
+#include <cassert>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
-template<typename ValueType, size_t D>
+//
+// Where the cells of an array are stored, given its extents. A layout
+// tells how many cells are stored, the offset of the cell at some indices
+// and, for each row (value of the first index), the extent of the second
+// index and the offset of its first cell. The cells of a row are
+// contiguous, in row major order.
+//
+// A layout is built from the extents of its array, which it is given again
+// by each call.
+//
+// next_row and previous_row give the offset of the cell at (row + 1,
+// m_next) or (row - 1, m_next) from that of the cell at (row, m), for
+// callers following a path through the first two indices one row at a
+// time (see basic_instance::advance).
+//
+// The cells of the layouts whose rows are not contiguous are copied to
+// and from the datafile buffers a cell at a time (see
+// hdf5::detail::copy_row).
+//
+namespace layouts {
+  // the elements for a unit of the second index
+  template<size_t D>
+  size_t inner_size(size_t const* extents)
+  {
+    return std::accumulate(extents + std::min<size_t>(D, 2), extents + D,
+                           size_t(1), std::multiplies<size_t>());
+  }
+
+  // row major, all the cells of the extents
+  template<size_t D>
+  struct dense {
+    static const bool is_dense = true;
+    static const bool contiguous_rows = true;
+
+    dense() = default;
+    explicit dense(size_t const*) { }
+
+    size_t size(size_t const* extents) const
+    {
+      return std::accumulate(extents, extents + D,
+                             size_t(1), std::multiplies<size_t>());
+    }
+
+    size_t row_extent(size_t const* extents, size_t) const
+    {
+      return D > 1 ? extents[1] : 1;
+    }
+
+    size_t row_offset(size_t const* extents, size_t row) const
+    {
+      return row * row_extent(extents, row) * inner_size<D>(extents);
+    }
+
+    template<typename IndexList>
+    size_t offset(size_t const* extents, IndexList const& indices) const
+    {
+      size_t offset = indices[0];
+      for (size_t n = 1; n != D; ++n) {
+        assert(indices[n] < extents[n]);
+        offset = indices[n] + extents[n] * offset;
+      }
+      return offset;
+    }
+
+    size_t next_row(size_t const* extents, size_t at, size_t,
+                    size_t m, size_t m_next) const
+    {
+      return at + (extents[1] + m_next - m) * inner_size<D>(extents);
+    }
+
+    size_t previous_row(size_t const* extents, size_t at, size_t,
+                        size_t m, size_t m_next) const
+    {
+      size_t const inner = inner_size<D>(extents);
+      return at + m_next * inner - (extents[1] + m) * inner;
+    }
+  };
+
+  //
+  // Only the cells whose second index is at most half the first one, as
+  // for the flatperm histograms of walks by their number of doubly
+  // visited sites: row n has min(n / 2 + 1, extents[1]) cells, about half
+  // of a dense array. Where each row starts is kept in a table, a lookup
+  // costs less than computing it.
+  //
+  template<size_t D>
+  class jagged {
+    static_assert(D >= 2, "a jagged array has at least two dimensions");
+
+    // the cells of the second index before each row, and in all of them
+    std::vector<size_t> _start;
+
+  public:
+    static const bool is_dense = false;
+    static const bool contiguous_rows = true;
+
+    jagged() = default;
+
+    explicit jagged(size_t const* extents)
+      : _start(extents[0] + 1, 0)
+    {
+      for (size_t row = 0; row != extents[0]; ++row)
+        _start[row + 1] = _start[row] + row_extent(extents, row);
+    }
+
+    size_t size(size_t const* extents) const
+    {
+      return _start.empty() ? 0 : _start.back() * inner_size<D>(extents);
+    }
+
+    size_t row_extent(size_t const* extents, size_t row) const
+    {
+      return std::min(row / 2 + 1, extents[1]);
+    }
+
+    size_t row_offset(size_t const* extents, size_t row) const
+    {
+      return _start[row] * inner_size<D>(extents);
+    }
+
+    template<typename IndexList>
+    size_t offset(size_t const* extents, IndexList const& indices) const
+    {
+      assert(indices[0] < extents[0]);
+      assert(indices[1] < row_extent(extents, indices[0]));
+      size_t offset = _start[indices[0]] + indices[1];
+      for (size_t n = 2; n != D; ++n) {
+        assert(indices[n] < extents[n]);
+        offset = indices[n] + extents[n] * offset;
+      }
+      return offset;
+    }
+
+    size_t next_row(size_t const* extents, size_t at, size_t row,
+                    size_t m, size_t m_next) const
+    {
+      return at + (row_extent(extents, row) + m_next - m) * inner_size<D>(extents);
+    }
+
+    size_t previous_row(size_t const* extents, size_t at, size_t row,
+                        size_t m, size_t m_next) const
+    {
+      size_t const inner = inner_size<D>(extents);
+      return at + m_next * inner - (row_extent(extents, row - 1) + m) * inner;
+    }
+  };
+
+  //
+  // The cells of a jagged array by tiles of Rows by Cols cells, so that a
+  // path moving a row at a time stays within a tile for several steps
+  // rather than jumping a whole row each time: Cols cells further down the
+  // tile, instead of about row / 2. The tiles of each band of Rows rows are
+  // stored one after the other, those of the band as wide as its last row,
+  // each of them row major.
+  //
+  template<size_t D, size_t Rows = 8, size_t Cols = 8>
+  class tiled {
+    static_assert(D == 2, "only two dimensional arrays are tiled");
+
+    // the cells before each band
+    std::vector<size_t> _start;
+
+    static std::array<size_t, 2> at(size_t row, size_t m) { return {{ row, m }}; }
+
+  public:
+    static const bool is_dense = false;
+    static const bool contiguous_rows = false;
+
+    tiled() = default;
+
+    explicit tiled(size_t const* extents)
+      : _start((extents[0] + Rows - 1) / Rows + 1, 0)
+    {
+      for (size_t band = 0; band + 1 != _start.size(); ++band) {
+        size_t const last = std::min(band * Rows + Rows, extents[0]) - 1;
+        size_t const tiles = (row_extent(extents, last) + Cols - 1) / Cols;
+        _start[band + 1] = _start[band] + tiles * Rows * Cols;
+      }
+    }
+
+    size_t size(size_t const*) const
+    {
+      return _start.empty() ? 0 : _start.back();
+    }
+
+    size_t row_extent(size_t const* extents, size_t row) const
+    {
+      return std::min(row / 2 + 1, extents[1]);
+    }
+
+    template<typename IndexList>
+    size_t offset(size_t const* extents, IndexList const& indices) const
+    {
+      assert(indices[0] < extents[0]);
+      assert(indices[1] < row_extent(extents, indices[0]));
+      (void) extents;
+      size_t const row = indices[0], m = indices[1];
+      return _start[row / Rows] + (m / Cols) * Rows * Cols
+        + (row % Rows) * Cols + m % Cols;
+    }
+
+    size_t next_row(size_t const* extents, size_t offset_, size_t row,
+                    size_t m, size_t m_next) const
+    {
+      if ((row + 1) % Rows != 0 and m / Cols == m_next / Cols)
+        return offset_ + Cols + m_next - m;
+      return offset(extents, at(row + 1, m_next));
+    }
+
+    size_t previous_row(size_t const* extents, size_t offset_, size_t row,
+                        size_t m, size_t m_next) const
+    {
+      if (row % Rows != 0 and m / Cols == m_next / Cols)
+        return offset_ + m_next - (Cols + m);
+      return offset(extents, at(row - 1, m_next));
+    }
+  };
+}
+
+//////////////////////////////////////////////////////////////////////
+
+template<typename ValueType, size_t D, typename Layout = layouts::dense<D>>
 class my_array {
 public:
   static const size_t NumDims = D;
 
   typedef size_t size_type;
+  typedef Layout layout_type;
 
   typedef ValueType        value_type;
   typedef ValueType&       reference;
   typedef ValueType const& const_reference;
 
-  typedef typename std::vector<value_type>::iterator iterator;
-  typedef typename std::vector<value_type>::const_iterator const_iterator;
+  // the cells of large arrays may be on huge pages, see huge_pages::policy
+  typedef std::vector<value_type, huge_pages::policy<value_type>> storage_type;
+
+  typedef typename storage_type::iterator iterator;
+  typedef typename storage_type::const_iterator const_iterator;
 
 private:
   size_type __extents[NumDims];
-  std::vector<value_type> __data;
+  Layout __layout;
+  storage_type __data;
 
   template<size_t I>
   struct helper {
@@ -52,6 +287,7 @@ public:
   my_array(std::initializer_list<unsigned int> extents)
   {
     std::copy_n(std::begin(extents), NumDims, std::begin(__extents));
+    __layout = Layout(__extents);
     __data.resize(num_elements());
   }
 
@@ -59,6 +295,7 @@ public:
   my_array(ExtentList const& extents)
   {
     std::copy_n(std::begin(extents), NumDims, std::begin(__extents));
+    __layout = Layout(__extents);
     __data.resize(num_elements());
   }
 
@@ -67,10 +304,27 @@ public:
     return NumDims;
   }
 
+  // the elements stored, all of the extents unless the layout is jagged
   size_t num_elements() const
   {
-    return std::accumulate(std::begin(__extents), std::end(__extents),
-			   1, std::multiplies<size_type>());
+    return __layout.size(__extents);
+  }
+
+  bool empty() const { return __data.empty(); }
+
+  void fill(value_type const& value)
+  {
+    std::fill(__data.begin(), __data.end(), value);
+  }
+
+  // element-wise sum, both arrays must have the same extents
+  my_array& operator+=(my_array const& rhs)
+  {
+    assert(std::equal(std::begin(__extents), std::end(__extents),
+		      std::begin(rhs.__extents)));
+    std::transform(__data.begin(), __data.end(), rhs.__data.begin(),
+		   __data.begin(), std::plus<value_type>());
+    return *this;
   }
 
   iterator begin() { return __data.begin(); }
@@ -85,55 +339,547 @@ public:
   const size_type*
   shape() const { return &__extents[0]; }
 
+  // see layouts
+  size_t row_extent(size_t row) const { return __layout.row_extent(__extents, row); }
+  size_t row_offset(size_t row) const { return __layout.row_offset(__extents, row); }
+
   helper<1> operator[](size_type i)
   {
+    static_assert(Layout::is_dense, "operator[] needs a dense layout");
     return helper<0>{*this, 0}[i];
   }
 
+  // the position in data() of the cell at indices
+  template<typename IndexList>
+  size_t offset(IndexList const& indices) const
+  {
+    return __layout.offset(__extents, indices);
+  }
+
   template<typename IndexList>
   value_type& operator()(IndexList const& indices)
   {
-    size_type offset = indices[0];
-    for (size_type n = 1; n != NumDims; ++n) {
-      assert(indices[n] < __extents[n]);
-      offset = indices[n] + __extents[n] * offset;
-    }
+    return __data[offset(indices)];
+  }
+
+  // the cell at an offset, for callers which keep track of it themselves
+  value_type&       at(size_t offset)       { return __data[offset]; }
+  value_type const& at(size_t offset) const { return __data[offset]; }
+
+  // see layouts
+  size_t next_row(size_t at, size_t row, size_t m, size_t m_next) const
+  {
+    return __layout.next_row(__extents, at, row, m, m_next);
+  }
 
-    return __data[offset];
+  size_t previous_row(size_t at, size_t row, size_t m, size_t m_next) const
+  {
+    return __layout.previous_row(__extents, at, row, m, m_next);
+  }
+};
+
+//////////////////////////////////////////////////////////////////////
+
+//
+// The part of an array modified since the last clear(): for each value of
+// the first index (a row) the range of the second one, all of the others
+// included. Arrays always modified at the same indices, like the flatperm
+// histograms, can share one, which is then marked once for all of them.
+//
+class dirty_rows {
+  // [first, second), empty when first >= second
+  std::vector<std::pair<unsigned int, unsigned int>> ranges;
+
+public:
+  dirty_rows() = default;
+
+  explicit dirty_rows(size_t rows) : ranges(rows, {-1u, 0}) { }
+
+  size_t size() const { return ranges.size(); }
+
+  std::pair<unsigned int, unsigned int> const& operator[](size_t row) const
+  {
+    return ranges[row];
+  }
+
+  template<typename IndexList>
+  void mark(IndexList const& indices)
+  {
+    // the rows of one dimensional arrays are a single cell
+    unsigned int const m = indices.size() > 1 ? indices[1] : 0;
+    mark_row(indices[0], m, m + 1);
+  }
+
+  void mark_row(size_t row, unsigned int first, unsigned int last)
+  {
+    auto& r = ranges[row];
+    r.first  = std::min(r.first, first);
+    r.second = std::max(r.second, last);
+  }
+
+  void merge(dirty_rows const& o)
+  {
+    assert(o.size() == size());
+    for (size_t row = 0; row != size(); ++row)
+      mark_row(row, o[row].first, o[row].second);
+  }
+
+  void clear()
+  {
+    std::fill(ranges.begin(), ranges.end(),
+              std::pair<unsigned int, unsigned int>(-1u, 0));
   }
 };
 
 //////////////////////////////////////////////////////////////////////
 
 namespace hdf5 {
-  template <typename ValueType, size_t NumDims>
-  void load(handle loc, my_array<ValueType, NumDims>& h,
-	    const char* name)
+  // the dataset name in loc, created with the given storage if needed
+  template <size_t NumDims>
+  dataset open_or_create(handle loc, const char* name, datatype const& type,
+                         std::array<hsize_t, NumDims> const& extents,
+                         storage const& s)
+  {
+    if (link_exists(loc, name))
+      return dataset::open(loc, name);
+
+    dataset::create params(loc, name, type, dataspace::create_simple(extents));
+    s.apply(params, extents, H5Tget_size(type));
+    return dataset(params);
+  }
+
+  namespace detail {
+    // the stored elements of h as a one dimensional space, nothing selected
+    template <typename ValueType, size_t NumDims, typename Layout>
+    dataspace memory_space(my_array<ValueType, NumDims, Layout> const& h)
+    {
+      return dataspace::create_simple({ hsize_t(h.num_elements()) })
+        .select_none();
+    }
+
+    //
+    // Adds the cells [first, last) of the second index in row of h, with
+    // all of the further indices, to both the memory space (see above) and
+    // the file space, where the row is at start (along the first dimensions
+    // of the file space, before those of h)
+    //
+    template <typename ValueType, size_t NumDims, typename Layout, size_t Rank>
+    void select_row(my_array<ValueType, NumDims, Layout> const& h, size_t row,
+                    hsize_t first, hsize_t last,
+                    dataspace& space, dataspace& file_space,
+                    std::array<hsize_t, Rank> start)
+    {
+      static_assert(Rank >= NumDims, "the file has fewer dimensions");
+      size_t const skip = Rank - NumDims;
+
+      std::array<hsize_t, Rank> count;
+      std::fill(count.begin(), count.end(), 1);
+      std::copy(h.shape() + 2, h.shape() + NumDims, count.begin() + skip + 2);
+      start[skip + 1] = first;
+      count[skip + 1] = last - first;
+      file_space.select_hyperslab(H5S_SELECT_OR, start, count);
+
+      hsize_t const inner = layouts::inner_size<NumDims>(h.shape());
+      space.select_hyperslab(H5S_SELECT_OR,
+                             std::array<hsize_t, 1>{{ h.row_offset(row) + first * inner }},
+                             std::array<hsize_t, 1>{{ (last - first) * inner }});
+    }
+
+    //
+    // The rows 0, stride, 2 stride ... of h by bands, each a single block of
+    // the file space from the row at start on, along the first dimensions
+    // of the file space, before those of h: as many rows as a chunk of the
+    // dataset has, or as fit in storage::chunk_bytes. Each band is selected
+    // in file_space before f(first, rows, width, space) is called, with the
+    // first row of the band (in the file), their number, their cells and
+    // the memory space of a buffer of them.
+    //
+    template <typename ValueType, size_t NumDims, typename Layout, size_t Rank,
+              typename F>
+    void for_each_band(dataset const& d, dataspace& file_space,
+                       std::array<hsize_t, Rank> start, hsize_t stride,
+                       my_array<ValueType, NumDims, Layout> const& h, F f)
+    {
+      static_assert(Rank >= NumDims, "the file has fewer dimensions");
+      size_t const skip = Rank - NumDims;
+
+      size_t const inner = layouts::inner_size<NumDims>(h.shape());
+      hsize_t const rows = (h.shape()[0] + stride - 1) / stride;
+
+      std::vector<hsize_t> const chunk = d.get_chunk();
+      hsize_t const band = not chunk.empty() ? chunk[skip]
+        : std::max<hsize_t>(1, storage::chunk_bytes
+                            / (h.shape()[1] * inner * sizeof(ValueType)));
+
+      std::array<hsize_t, Rank> count;
+      std::fill(count.begin(), count.end(), 1);
+      std::copy(h.shape() + 1, h.shape() + NumDims, count.begin() + skip + 1);
+
+      hsize_t const first = start[skip];
+      for (hsize_t i = 0; i < rows; i += band) {
+        hsize_t const n = std::min(band, rows - i);
+        // the rows only get longer, the band is as wide as the last one
+        hsize_t const width = h.row_extent((i + n - 1) * stride);
+        start[skip] = first + i;
+        count[skip] = n;
+        count[skip + 1] = width;
+        file_space.select_hyperslab(H5S_SELECT_SET, start, count);
+        f(i, n, width * inner, dataspace::create_simple(count));
+      }
+    }
+
+    //
+    // The cells [first, last) of the second index in row of h, with all of
+    // the further indices, to out, and the whole row from in: at once when
+    // the layout keeps rows contiguous, else a cell at a time (the only such
+    // layout, tiled, has no further indices)
+    //
+    template <typename ValueType, size_t NumDims, typename Layout, typename Out>
+    Out copy_row(my_array<ValueType, NumDims, Layout> const& h, size_t row,
+                 size_t first, size_t last, Out out, std::true_type)
+    {
+      size_t const inner = layouts::inner_size<NumDims>(h.shape());
+      auto const cells = h.data() + h.row_offset(row);
+      return std::copy(cells + first * inner, cells + last * inner, out);
+    }
+
+    template <typename ValueType, size_t NumDims, typename Layout, typename Out>
+    Out copy_row(my_array<ValueType, NumDims, Layout> const& h, size_t row,
+                 size_t first, size_t last, Out out, std::false_type)
+    {
+      std::array<size_t, 2> i{{ row, first }};
+      for (; i[1] != last; ++i[1])
+        *out++ = h.at(h.offset(i));
+      return out;
+    }
+
+    template <typename ValueType, size_t NumDims, typename Layout, typename Out>
+    Out copy_row(my_array<ValueType, NumDims, Layout> const& h, size_t row,
+                 size_t first, size_t last, Out out)
+    {
+      return copy_row(h, row, first, last, out,
+                      std::integral_constant<bool, Layout::contiguous_rows>());
+    }
+
+    template <typename In, typename ValueType, size_t NumDims, typename Layout>
+    void copy_row(In in, my_array<ValueType, NumDims, Layout>& h, size_t row,
+                  std::true_type)
+    {
+      size_t const inner = layouts::inner_size<NumDims>(h.shape());
+      std::copy_n(in, h.row_extent(row) * inner, h.data() + h.row_offset(row));
+    }
+
+    template <typename In, typename ValueType, size_t NumDims, typename Layout>
+    void copy_row(In in, my_array<ValueType, NumDims, Layout>& h, size_t row,
+                  std::false_type)
+    {
+      std::array<size_t, 2> i{{ row, 0 }};
+      for (; i[1] != h.row_extent(row); ++i[1])
+        h.at(h.offset(i)) = *in++;
+    }
+
+    template <typename In, typename ValueType, size_t NumDims, typename Layout>
+    void copy_row(In in, my_array<ValueType, NumDims, Layout>& h, size_t row)
+    {
+      copy_row(in, h, row, std::integral_constant<bool, Layout::contiguous_rows>());
+    }
+
+    //
+    // The rows of h as stored by its layout, through a buffer of all of the
+    // extents of a band (see for_each_band): the cells the layout does not
+    // keep are written as zero, those read are dropped
+    //
+    template <typename ValueType, size_t NumDims, typename Layout, size_t Rank>
+    void write_rows(dataset& d, datatype const& type, dataspace& file_space,
+                    std::array<hsize_t, Rank> const& start, hsize_t stride,
+                    my_array<ValueType, NumDims, Layout> const& h)
+    {
+      std::vector<ValueType> buffer;
+      for_each_band(d, file_space, start, stride, h,
+                    [&](hsize_t first, hsize_t rows, size_t width,
+                        dataspace const& space) {
+        buffer.assign(rows * width, ValueType());
+        for (hsize_t k = 0; k != rows; ++k) {
+          size_t const row = (first + k) * stride;
+          copy_row(h, row, 0, h.row_extent(row), buffer.begin() + k * width);
+        }
+        d.write(type, space, file_space, buffer.data());
+      });
+    }
+
+    template <typename ValueType, size_t NumDims, typename Layout, size_t Rank>
+    void read_rows(dataset& d, datatype const& type, dataspace& file_space,
+                   std::array<hsize_t, Rank> const& start,
+                   my_array<ValueType, NumDims, Layout>& h)
+    {
+      std::vector<ValueType> buffer;
+      for_each_band(d, file_space, start, 1, h,
+                    [&](hsize_t first, hsize_t rows, size_t width,
+                        dataspace const& space) {
+        buffer.resize(rows * width);
+        d.read(type, space, file_space, buffer.data());
+        for (hsize_t k = 0; k != rows; ++k) {
+          size_t const row = first + k;
+          copy_row(buffer.begin() + k * width, h, row);
+        }
+      });
+    }
+  }
+
+  //
+  // The datasets always have all of the extents of the arrays. Arrays
+  // with a jagged layout only store some of the cells: the others are
+  // written as zero with them and dropped when read (see
+  // detail::write_rows), and left alone by the saves of dirty rows.
+  //
+  template <typename ValueType, size_t NumDims, typename Layout>
+  void
+  load(handle loc, my_array<ValueType, NumDims, Layout>& h,
+       const char* name, storage const& s = storage())
   {
     datatype type = datatype_from<ValueType>::value();
     std::array<hsize_t, NumDims> extents;
     std::copy(h.shape(), h.shape() + NumDims, extents.begin());
     dataspace space = dataspace::create_simple(extents);
 
-    ( link_exists(loc, name)
-      ? dataset::open(loc, name)
-      : dataset::create(loc, name, type, space) )
-      .read(type, space, h.data());
+    dataset d = open_or_create(loc, name, type, extents, s);
+
+    if (Layout::is_dense) {
+      d.read(type, space, h.data());
+      return;
+    }
+
+    dataspace file_space = d.get_space();
+    std::array<hsize_t, NumDims> start;
+    std::fill(start.begin(), start.end(), 0);
+    detail::read_rows(d, type, file_space, start, h);
   }
 
-  template <typename ValueType, size_t NumDims>
-  void save(handle loc, my_array<ValueType, NumDims> const& h,
-	    const char* name)
+  //
+  // With dirty, only the rows it marks are written and the dataset must
+  // already be there with the same extents. One dimensional arrays are
+  // always written in full.
+  //
+  // Each dirty row of a contiguous dataset is written on its own, straight
+  // from memory. A chunked one is written at once through the union of the
+  // rows, so that each of its chunks is filtered only once. A jagged array
+  // in full is written by bands of rows (see detail::write_rows) instead,
+  // HDF5 is slow at the union of that many rows.
+  //
+  template <typename ValueType, size_t NumDims, typename Layout>
+  std::enable_if_t<Layout::contiguous_rows>
+  save(handle loc, my_array<ValueType, NumDims, Layout> const& h,
+       const char* name, storage const& s = storage(),
+       dirty_rows const* dirty = nullptr)
   {
     datatype type = datatype_from<ValueType>::value();
     std::array<hsize_t, NumDims> extents;
     std::copy(h.shape(), h.shape() + NumDims, extents.begin());
     dataspace space = dataspace::create_simple(extents);
 
-    ( link_exists(loc, name)
-      ? dataset::open(loc, name)
-      : dataset::create(loc, name, type, space) )
-      .write(type, space, h.data());
+    dataset d = open_or_create(loc, name, type, extents, s);
+
+    if (NumDims < 2 or (Layout::is_dense and not dirty)) {
+      d.write(type, space, h.data());
+      return;
+    }
+
+    if (not dirty) {
+      dataspace file_space = d.get_space();
+      std::array<hsize_t, NumDims> start;
+      std::fill(start.begin(), start.end(), 0);
+      detail::write_rows(d, type, file_space, start, 1, h);
+      return;
+    }
+
+    assert(dirty->size() == extents[0]);
+
+    bool const chunked = d.get_layout() == H5D_CHUNKED;
+
+    dataspace file_space = d.get_space();
+    file_space.select_none();
+    dataspace memory = detail::memory_space(h);
+
+    // the elements for a unit of the second index
+    size_t const stride = layouts::inner_size<NumDims>(h.shape());
+
+    std::array<hsize_t, NumDims> start, count = extents;
+    std::fill(start.begin(), start.end(), 0);
+    for (size_t row = 0; row != dirty->size(); ++row) {
+      auto const& r = (*dirty)[row];
+      if (r.first >= r.second)
+        continue;
+      start[0] = row;
+      if (chunked) {
+        detail::select_row(h, row, r.first, r.second, memory, file_space, start);
+      } else {
+        count[0] = 1;
+        start[1] = r.first;
+        count[1] = r.second - r.first;
+        file_space.select_hyperslab(H5S_SELECT_SET, start, count);
+        d.write(type, dataspace::create_simple(count), file_space,
+                h.data() + h.row_offset(row) + r.first * stride);
+      }
+    }
+
+    if (chunked and memory.get_select_npoints() != 0)
+      d.write(type, memory, file_space, h.data());
+  }
+
+  //////////////////////////////////////////////////////////////////////
+  // time series
+  //////////////////////////////////////////////////////////////////////
+
+  namespace detail {
+    //
+    // A new slice at the end of the dataset name, whose first dimension
+    // counts the slices and is unlimited, created by the first call with
+    // slices of the given extents. Returns the dataset and the file space
+    // with the new slice selected.
+    //
+    template <size_t Rank>
+    std::pair<dataset, dataspace>
+    new_slice(handle loc, const char* name, datatype const& type,
+              std::array<hsize_t, Rank> const& slice, storage const& s)
+    {
+      std::array<hsize_t, Rank> dims = slice, max_dims = slice;
+      dims[0] = 0;
+      max_dims[0] = H5S_UNLIMITED;
+
+      dataset d;
+      if (link_exists(loc, name)) {
+        d = dataset::open(loc, name);
+      } else {
+        // unlimited dimensions need chunks, a slice each by default
+        storage chunked = s;
+        if (not chunked.chunked())
+          chunked.chunk.assign(slice.begin(), slice.end());
+        dataset::create params(loc, name, type,
+                               dataspace::create_simple(Rank, dims.data(),
+                                                        max_dims.data()));
+        chunked.apply(params, max_dims, H5Tget_size(type));
+        d = dataset(params);
+      }
+
+      d.get_space().get_simple_extent_dims(dims);
+      if (not std::equal(dims.begin() + 1, dims.end(), slice.begin() + 1))
+        throw std::runtime_error(std::string("appending to ") + name
+                                 + ": the slices have other extents");
+
+      std::array<hsize_t, Rank> start;
+      std::fill(start.begin(), start.end(), 0);
+      start[0] = dims[0];
+      dims[0] += 1;
+      d.set_extent(dims.data());
+
+      dataspace file_space = d.get_space();
+      file_space.select_hyperslab(H5S_SELECT_SET, start, slice);
+      return std::make_pair(d, std::move(file_space));
+    }
+  }
+
+  //
+  // Append h, or only its rows 0, stride, 2 stride ... along the first
+  // index, as a new slice of the dataset name (see detail::new_slice)
+  //
+  template <typename ValueType, size_t NumDims, typename Layout>
+  void
+  append(handle loc, my_array<ValueType, NumDims, Layout> const& h,
+         const char* name, storage const& s = storage(),
+         hsize_t stride = 1)
+  {
+    datatype type = datatype_from<ValueType>::value();
+    std::array<hsize_t, NumDims> extents;
+    std::copy(h.shape(), h.shape() + NumDims, extents.begin());
+
+    std::array<hsize_t, NumDims> start, step, count = extents;
+    std::fill(start.begin(), start.end(), 0);
+    std::fill(step.begin(), step.end(), 1);
+    step[0] = stride;
+    count[0] = (extents[0] + stride - 1) / stride;
+
+    std::array<hsize_t, NumDims + 1> slice;
+    slice[0] = 1;
+    std::copy(count.begin(), count.end(), slice.begin() + 1);
+
+    auto target = detail::new_slice(loc, name, type, slice, s);
+    dataset d = target.first;
+    dataspace& file_space = target.second;
+
+    if (Layout::is_dense) {
+      dataspace space = dataspace::create_simple(extents);
+      space.select_hyperslab(H5S_SELECT_SET, start, step, count);
+      d.write(type, space, file_space, h.data());
+      return;
+    }
+
+    std::array<hsize_t, NumDims + 1> at;
+    file_space.get_simple_extent_dims(at);
+    at[0] -= 1;
+    std::fill(at.begin() + 1, at.end(), 0);
+    detail::write_rows(d, type, file_space, at, stride, h);
+  }
+
+  //
+  // Arrays whose rows are not contiguous (see layouts) in full as the others
+  // are, by bands of rows. The dirty rows cannot be written from memory,
+  // they are copied to a buffer of them alone instead, in the order of the
+  // union of their selections, which is written at once.
+  //
+  template <typename ValueType, size_t NumDims, typename Layout>
+  std::enable_if_t<not Layout::contiguous_rows>
+  save(handle loc, my_array<ValueType, NumDims, Layout> const& h,
+       const char* name, storage const& s = storage(),
+       dirty_rows const* dirty = nullptr)
+  {
+    static_assert(NumDims == 2, "only two dimensional arrays are not by rows");
+
+    datatype type = datatype_from<ValueType>::value();
+    std::array<hsize_t, NumDims> extents;
+    std::copy(h.shape(), h.shape() + NumDims, extents.begin());
+
+    dataset d = open_or_create(loc, name, type, extents, s);
+    dataspace file_space = d.get_space();
+
+    std::array<hsize_t, NumDims> start, count;
+    std::fill(start.begin(), start.end(), 0);
+
+    if (not dirty) {
+      detail::write_rows(d, type, file_space, start, 1, h);
+      return;
+    }
+
+    assert(dirty->size() == extents[0]);
+
+    file_space.select_none();
+    std::vector<ValueType> buffer;
+    for (size_t row = 0; row != dirty->size(); ++row) {
+      auto const& r = (*dirty)[row];
+      if (r.first >= r.second)
+        continue;
+      start[0] = row;
+      start[1] = r.first;
+      count[0] = 1;
+      count[1] = r.second - r.first;
+      file_space.select_hyperslab(H5S_SELECT_OR, start, count);
+      detail::copy_row(h, row, r.first, r.second, std::back_inserter(buffer));
+    }
+
+    if (not buffer.empty())
+      d.write(type, dataspace::create_simple({ hsize_t(buffer.size()) }),
+              file_space, buffer.data());
+  }
+
+  template <typename T>
+  void append_scalar(handle loc, T const& value, const char* name)
+  {
+    datatype type = datatype_from<T>::value();
+    storage s;
+    s.chunk = { 1024 };
+    auto const target = detail::new_slice(loc, name, type,
+                                          std::array<hsize_t, 1>{{ 1 }}, s);
+    dataset d = target.first;
+    d.write(type, dataspace::create_scalar(), target.second, &value);
   }
 }
 
@@ -0,0 +1,255 @@
+/*
+ * parallel.hpp
+ *
+ */
+
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace algorithm {
+  //
+  // Runs whole flatperm tours on several threads.
+  //
+  // Every worker is a complete instance of its own (walk, features, random
+  // number generator and histograms) but its histograms only hold what it
+  // sampled since it last synchronised with the master instance. When
+  // synchronising, a worker adds these deltas to the master histograms and
+  // picks up the target weights last published, which it combines with its
+  // own deltas to decide about pruning and enrichment.
+  //
+  // The target weights (see flatperm::estimates) are a single read only
+  // copy shared by all the workers. The deltas merged since it was made
+  // are also kept apart, so that a syncing worker can publish the next one
+  // from the last one and these without holding the lock that the other
+  // workers need to merge.
+  //
+  // Workers synchronise between tours, every refresh_interval or as soon
+  // as reduce() asks them to, e.g. before a checkpoint.
+  //
+  // Once there are no more tours to start, idle workers steal pending
+  // enrichments from the histories of the busy ones (see flatperm::steal)
+  // so that a few large tours do not leave the other cores waiting.
+  //
+  template<typename Instance>
+  class tour_parallel {
+    Instance& master;
+    std::vector<std::unique_ptr<Instance>> workers;
+
+    std::atomic<uint64_t> next_tour;
+    uint64_t last_tour;
+
+    // workers running a tour or a stolen branch, or looking for one
+    std::atomic<unsigned int> active;
+
+    boost::posix_time::time_duration const refresh_interval;
+
+    // reduce() bumps the generation, each worker records the last
+    // generation it has merged, both guarded by mutex
+    boost::mutex mutex;
+    boost::condition_variable synced;
+    std::atomic<unsigned int> generation;
+    std::vector<unsigned int> seen;
+    std::vector<bool> running;
+
+    using estimates = typename Instance::flatperm_type::estimates;
+
+    // the deltas merged since the estimates were last published, guarded
+    // by mutex, and a cleared one to swap with them; only the worker set
+    // in publishing touches spare and stores published, which the other
+    // ones load atomically
+    std::unique_ptr<estimates> pending, spare;
+    std::shared_ptr<estimates const> published;
+    std::atomic<bool> publishing;
+
+  public:
+    tour_parallel(Instance& master, unsigned int threads)
+      : master(master)
+      , next_tour(0)
+      , last_tour(0)
+      , active(0)
+      , refresh_interval(boost::posix_time::seconds(1))
+      , generation(0)
+      , seen(threads, 0)
+      , running(threads, false)
+      , pending(new estimates(master.flatperm.extents))
+      , spare(new estimates(master.flatperm.extents))
+      , publishing(false)
+    {
+      auto e = std::make_shared<estimates>(master.flatperm.extents);
+      e->add(master.flatperm.cells);
+      published = e;
+
+      std::cerr << "starting " << threads << " workers\n";
+      for (unsigned int k = 0; k != threads; ++k) {
+        workers.emplace_back(new Instance(master.N, master.mu));
+        workers.back()->rng = engines::fork(master.rng);
+        workers.back()->refresh(published);
+        workers.back()->flatperm.shared = true;
+      }
+    }
+
+    // the workers, e.g. to read their live counters while they run
+    unsigned int size() const { return workers.size(); }
+    Instance const& worker(unsigned int k) const { return *workers[k]; }
+
+    void run(unsigned int S)
+    {
+      master.start_time = boost::posix_time::second_clock::local_time();
+
+      next_tour = master.flatperm.tours();
+      last_tour = next_tour + S;
+
+      std::cerr << "I already have " << next_tour << " tours, starting " << S
+        << " up to " << last_tour << "\n";
+
+      boost::thread_group threads;
+      for (unsigned int k = 0; k != workers.size(); ++k)
+        threads.create_thread([this, k] { work(k); });
+
+      try {
+        threads.join_all();
+      } catch (boost::thread_interrupted const&) {
+        threads.interrupt_all();
+        threads.join_all();
+        throw;
+      }
+    }
+
+    //
+    // Have every running worker merge its histograms into the master, then
+    // call f while they are held back, so that f sees a consistent state.
+    // Keep f short, e.g. take a snapshot of the master to be saved once
+    // reduce() has returned.
+    //
+    template<typename F>
+    void reduce(F f)
+    {
+      boost::unique_lock<boost::mutex> lock(mutex);
+      unsigned int const g = ++generation;
+      synced.wait(lock, [&] {
+          for (unsigned int k = 0; k != workers.size(); ++k)
+            if (running[k] and seen[k] != g)
+              return false;
+          return true;
+        });
+      f();
+    }
+
+  private:
+    void work(unsigned int k)
+    {
+      namespace pt = boost::posix_time;
+
+      Instance& worker = *workers[k];
+      {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        running[k] = true;
+        seen[k] = generation;
+      }
+
+      pt::ptime last_sync = pt::microsec_clock::universal_time();
+
+      auto maybe_sync = [&] {
+        pt::ptime const now = pt::microsec_clock::universal_time();
+        if (seen[k] != generation or now - last_sync > refresh_interval) {
+          sync(k);
+          last_sync = now;
+        }
+      };
+
+      try {
+        active++;
+        uint64_t S;
+        while ((S = next_tour++) < last_tour) {
+          worker.flatperm.tour(&worker, S + 1);
+          maybe_sync();
+        }
+        active--;
+
+        typename decltype(worker.flatperm)::branch b;
+        while (true) {
+          // a worker is counted as active before it looks for a branch, so
+          // that no work can be in flight when active drops to zero
+          active++;
+          bool const found = steal(k, b);
+          if (found)
+            worker.flatperm.resume(&worker, b);
+          active--;
+
+          maybe_sync();
+
+          if (not found) {
+            if (active == 0)
+              break;
+            boost::this_thread::sleep(pt::microseconds(100));
+          }
+        }
+      } catch (boost::thread_interrupted const&) {
+        // keep what has been sampled so far, as a serial run would
+        sync(k, false);
+        return;
+      }
+      sync(k, false);
+    }
+
+    bool steal(unsigned int k, typename decltype(master.flatperm)::branch& b)
+    {
+      for (unsigned int i = 1; i != workers.size(); ++i) {
+        Instance& victim = *workers[(k + i) % workers.size()];
+        if (victim.flatperm.steal(victim.walk, b))
+          return true;
+      }
+      return false;
+    }
+
+    void sync(unsigned int k, bool keep_running = true)
+    {
+      {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        pending->add(workers[k]->flatperm.cells);
+        master.merge(*workers[k]);
+        seen[k] = generation;
+        running[k] = keep_running;
+        synced.notify_all();
+      }
+      if (keep_running) {
+        publish();
+        workers[k]->refresh(std::atomic_load(&published));
+      }
+    }
+
+    //
+    // Publish the estimates with the deltas pending added, unless another
+    // worker is already at it. Only swapping the deltas holds the lock.
+    //
+    void publish()
+    {
+      if (publishing.exchange(true))
+        return;
+      {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        std::swap(pending, spare);
+      }
+      auto e = std::make_shared<estimates>(*std::atomic_load(&published));
+      e->add(*spare);
+      spare->clear();
+      std::atomic_store(&published, std::shared_ptr<estimates const>(e));
+      publishing = false;
+    }
+  };
+}
+
+#endif // PARALLEL_HPP
+
+// vim: noai:ts=2:sw=2
@@ -0,0 +1,270 @@
+/*
+ * random_engines.hpp
+ *
+ */
+
+#ifndef RANDOM_ENGINES_HPP
+#define RANDOM_ENGINES_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <iterator>
+#include <limits>
+#include <ostream>
+#include <random>
+
+//
+// Random engines for flatperm, to be used in place of std::mt19937 (see
+// instance::random_generator_type). All of them are uniform random bit
+// generators and can be written to and read from a stream, which is how
+// their state ends up in the datafile.
+//
+// flatperm draws through uniform01() and shuffle() below rather than
+// std::uniform_real_distribution and std::shuffle. These fall back to the
+// standard library for any other engine, so that std::mt19937 runs are not
+// changed, and take a cheaper path for the engines of this file.
+//
+namespace engines {
+  //
+  // xoshiro256++ by D. Blackman and S. Vigna, seeded through splitmix64
+  //
+  class xoshiro256pp {
+    std::array<uint64_t, 4> s;
+
+    static uint64_t rotl(uint64_t x, int k) {
+      return (x << k) | (x >> (64 - k));
+    }
+
+  public:
+    typedef uint64_t result_type;
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    explicit xoshiro256pp(uint64_t value = 1) { seed(value); }
+
+    void seed(uint64_t value)
+    {
+      for (auto& x : s) {
+        uint64_t z = (value += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        x = z ^ (z >> 31);
+      }
+    }
+
+    result_type operator()()
+    {
+      uint64_t const result = rotl(s[0] + s[3], 23) + s[0];
+      uint64_t const t = s[1] << 17;
+
+      s[2] ^= s[0];
+      s[3] ^= s[1];
+      s[1] ^= s[2];
+      s[0] ^= s[3];
+      s[2] ^= t;
+      s[3] = rotl(s[3], 45);
+
+      return result;
+    }
+
+    friend std::ostream& operator<<(std::ostream& o, xoshiro256pp const& g) {
+      return o << g.s[0] << " " << g.s[1] << " " << g.s[2] << " " << g.s[3];
+    }
+
+    friend std::istream& operator>>(std::istream& i, xoshiro256pp& g) {
+      return i >> g.s[0] >> g.s[1] >> g.s[2] >> g.s[3];
+    }
+  };
+
+  //
+  // Philox4x32-10 by J. Salmon et al. (Random123), a counter-based engine:
+  // the output is a bijection of a 128 bits counter under a 64 bits key,
+  // so that streams with different keys or counters never overlap.
+  //
+  // The key is set by seed() and the high half of the counter by
+  // restart(stream), the low half counts the blocks drawn since then.
+  // flatperm restarts the engine with the tour number at the beginning of
+  // each tour, which then draws the same numbers whoever runs it.
+  //
+  class philox4x32 {
+    std::array<uint32_t, 2> _key;
+    std::array<uint32_t, 4> _counter;
+    std::array<uint64_t, 2> _output;
+    unsigned int _next;
+
+    void generate()
+    {
+      uint32_t c0 = _counter[0], c1 = _counter[1];
+      uint32_t c2 = _counter[2], c3 = _counter[3];
+      uint32_t k0 = _key[0], k1 = _key[1];
+      for (int round = 0; round != 10; ++round) {
+        uint64_t const p0 = uint64_t(0xd2511f53) * c0;
+        uint64_t const p1 = uint64_t(0xcd9e8d57) * c2;
+        c0 = uint32_t(p1 >> 32) ^ c1 ^ k0;
+        c1 = uint32_t(p1);
+        c2 = uint32_t(p0 >> 32) ^ c3 ^ k1;
+        c3 = uint32_t(p0);
+        k0 += 0x9e3779b9;
+        k1 += 0xbb67ae85;
+      }
+      _output[0] = (uint64_t(c1) << 32) | c0;
+      _output[1] = (uint64_t(c3) << 32) | c2;
+      _next = 0;
+
+      if (++_counter[0] == 0)
+        ++_counter[1];
+    }
+
+  public:
+    typedef uint64_t result_type;
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    explicit philox4x32(uint64_t key = 1) { seed(key); }
+
+    void seed(uint64_t key)
+    {
+      _key = {{ uint32_t(key), uint32_t(key >> 32) }};
+      restart(0);
+    }
+
+    void restart(uint64_t stream)
+    {
+      _counter = {{ 0, 0, uint32_t(stream), uint32_t(stream >> 32) }};
+      _next = 2;
+    }
+
+    result_type operator()()
+    {
+      if (_next == 2)
+        generate();
+      return _output[_next++];
+    }
+
+    friend std::ostream& operator<<(std::ostream& o, philox4x32 const& g) {
+      o << g._key[0] << " " << g._key[1];
+      for (auto x : g._counter)
+        o << " " << x;
+      return o << " " << g._next << " " << g._output[0] << " " << g._output[1];
+    }
+
+    friend std::istream& operator>>(std::istream& i, philox4x32& g) {
+      i >> g._key[0] >> g._key[1];
+      for (auto& x : g._counter)
+        i >> x;
+      i >> g._next >> g._output[0] >> g._output[1];
+      if (g._next > 2)
+        i.setstate(std::ios::failbit);
+      return i;
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////
+
+  template<typename Engine>
+  struct is_counter_based : std::false_type { };
+
+  template<>
+  struct is_counter_based<philox4x32> : std::true_type { };
+
+  namespace detail {
+    template<typename Engine>
+    struct is_fast : std::false_type { };
+
+    template<>
+    struct is_fast<xoshiro256pp> : std::true_type { };
+
+    template<>
+    struct is_fast<philox4x32> : std::true_type { };
+
+    // a double in [0, 1) from the top 53 bits of a (64 bits) word
+    template<typename Engine>
+    double uniform01(Engine& g, std::true_type)
+    {
+      return (g() >> 11) * (1.0 / (uint64_t(1) << 53));
+    }
+
+    template<typename Engine>
+    double uniform01(Engine& g, std::false_type)
+    {
+      return std::uniform_real_distribution<double>()(g);
+    }
+
+    // an integer in [0, n) with Lemire's multiply and reject method
+    template<typename Engine>
+    uint32_t bounded(Engine& g, uint32_t n)
+    {
+      uint64_t m = (g() >> 32) * n;
+      if (uint32_t(m) < n) {
+        uint32_t const threshold = -n % n;
+        while (uint32_t(m) < threshold)
+          m = (g() >> 32) * n;
+      }
+      return m >> 32;
+    }
+
+    template<typename RandomIt, typename Engine>
+    void shuffle(RandomIt first, RandomIt last, Engine& g, std::true_type)
+    {
+      for (auto n = last - first; n > 1; --n)
+        std::iter_swap(first + n - 1, first + bounded(g, n));
+    }
+
+    template<typename RandomIt, typename Engine>
+    void shuffle(RandomIt first, RandomIt last, Engine& g, std::false_type)
+    {
+      std::shuffle(first, last, g);
+    }
+
+    template<typename Engine>
+    void restart(Engine& g, uint64_t stream, std::true_type) { g.restart(stream); }
+
+    template<typename Engine>
+    void restart(Engine&, uint64_t, std::false_type) { }
+
+    template<typename Engine>
+    Engine fork(Engine& g, std::true_type) { return g; }
+
+    template<typename Engine>
+    Engine fork(Engine& g, std::false_type) { return Engine(g()); }
+  }
+
+  // start the given stream, only counter-based engines have streams
+  template<typename Engine>
+  void restart(Engine& g, uint64_t stream)
+  {
+    detail::restart(g, stream, is_counter_based<Engine>());
+  }
+
+  //
+  // The engine for a worker of a parallel run: a copy of g for
+  // counter-based engines, whose streams are told apart by restart(), and
+  // otherwise an engine seeded from g
+  //
+  template<typename Engine>
+  Engine fork(Engine& g)
+  {
+    return detail::fork(g, is_counter_based<Engine>());
+  }
+
+  // a uniform double in [0, 1)
+  template<typename Engine>
+  double uniform01(Engine& g)
+  {
+    return detail::uniform01(g, detail::is_fast<Engine>());
+  }
+
+  template<typename RandomIt, typename Engine>
+  void shuffle(RandomIt first, RandomIt last, Engine& g)
+  {
+    detail::shuffle(first, last, g, detail::is_fast<Engine>());
+  }
+}
+
+#endif // RANDOM_ENGINES_HPP
+
+// vim: noai:ts=2:sw=2
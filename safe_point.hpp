@@ -0,0 +1,106 @@
+/*
+ * safe_point.hpp
+ *
+ */
+
+#ifndef SAFE_POINT_HPP
+#define SAFE_POINT_HPP
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <atomic>
+
+namespace algorithm {
+  //
+  // Consistent snapshots of an instance run by another thread.
+  //
+  // The thread running the instance calls the safe point between tours
+  // (see flatperm::run), where the histograms, the counters and the state
+  // of the random generator agree with each other. take() asks for a
+  // snapshot and waits for the sampler to copy the instance at its next
+  // safe point: the sampler is held back for the copy only, saving it is
+  // left to the caller.
+  //
+  // Once the sampler has called close() the instance is not modified any
+  // more and take() copies it directly. Only one thread at a time may call
+  // take().
+  //
+  template<typename Instance>
+  class safe_point {
+    using snapshot_type = typename Instance::snapshot_type;
+
+    Instance& instance;
+
+    std::atomic<bool> requested;
+    std::atomic<bool> stopping;
+
+    // guard target and closed
+    boost::mutex mutex;
+    boost::condition_variable taken;
+    snapshot_type* target;
+    bool closed;
+
+  public:
+    explicit safe_point(Instance& instance)
+      : instance(instance)
+      , requested(false)
+      , stopping(false)
+      , target(nullptr)
+      , closed(false)
+    {
+    }
+
+    // the sampler side: false once it has been asked to stop
+    bool operator()()
+    {
+      if (requested.load(std::memory_order_acquire)) {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        instance.snapshot(*target);
+        target = nullptr;
+        requested = false;
+        taken.notify_all();
+      }
+      return not stopping.load(std::memory_order_relaxed);
+    }
+
+    // the sampler has stopped, whether it ran all its tours or not
+    void close()
+    {
+      boost::lock_guard<boost::mutex> lock(mutex);
+      closed = true;
+      taken.notify_all();
+    }
+
+    // have the sampler stop at its next safe point
+    void stop()
+    {
+      stopping = true;
+    }
+
+    // copy the instance into s, see Instance::snapshot
+    void take(snapshot_type& s)
+    {
+      boost::unique_lock<boost::mutex> lock(mutex);
+      if (closed) {
+        instance.snapshot(s);
+        return;
+      }
+
+      target = &s;
+      requested = true;
+      taken.wait(lock, [this] { return target == nullptr or closed; });
+      requested = false;
+
+      // the sampler stopped before reaching a safe point
+      if (target != nullptr) {
+        target = nullptr;
+        instance.snapshot(s);
+      }
+    }
+  };
+}
+
+#endif // SAFE_POINT_HPP
+
+// vim: noai:ts=2:sw=2
@@ -0,0 +1,131 @@
+/*
+ * sites.hpp
+ *
+ */
+
+#ifndef SITES_HPP
+#define SITES_HPP
+
+#include "huge_pages.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+//
+// Tables holding a Value for each lattice site visited by a walk of length
+// at most N. They are used as a policy by models::walk.
+//
+// Their memory comes from huge_pages::policy, on huge pages if so built.
+//
+//   Sites(N)           construct a table for walks up to length N
+//   operator[](p)      the value at p, default constructed if needed
+//   find(p)            a pointer to the value at p, or nullptr
+//   size()             number of sites allocated so far
+//
+namespace sites {
+  //
+  // A hash map, it works for any walk length and keeps only the sites that
+  // have been visited.
+  //
+  template<typename Lattice, typename Value>
+  class hashed {
+    using point = typename Lattice::point;
+
+    std::unordered_map<point, Value, typename Lattice::hash, std::equal_to<point>,
+                       huge_pages::policy<std::pair<point const, Value>>> _map;
+
+  public:
+    hashed(unsigned int = 0) { }
+
+    Value& operator[](point const& p) { return _map[p]; }
+
+    Value const* find(point const& p) const
+    {
+      auto it = _map.find(p);
+      return it == _map.end() ? nullptr : &it->second;
+    }
+
+    std::size_t size() const { return _map.size(); }
+  };
+
+  //
+  // A dense grid covering the (2N+1)^2 window that a walk of length N can
+  // reach. The window is split into square pages which are only allocated
+  // when the walk first gets there, so that memory stays proportional to
+  // the region actually visited even for very large N. They are allocated
+  // by slabs filling a huge page when the policy maps them, by one else.
+  //
+  template<typename Lattice, typename Value>
+  class grid {
+    using point = typename Lattice::point;
+
+    static const unsigned int page_bits = 6;
+    static const unsigned int page_side = 1u << page_bits;
+    static const unsigned int page_mask = page_side - 1;
+
+    static const std::size_t page_cells = page_side * page_side;
+    static const std::size_t slab_pages =
+      huge_pages::blocks_per_allocation(page_cells * sizeof(Value));
+
+    using slab = std::vector<Value, huge_pages::policy<Value>>;
+
+    int const _offset;
+    std::size_t const _pages_per_side;
+    std::vector<Value*, huge_pages::policy<Value*>> _pages;
+    std::vector<slab> _slabs;
+    std::size_t _allocated;
+
+    // returns the page index and sets cell to the index inside the page
+    std::size_t locate(point const& p, std::size_t& cell) const
+    {
+      std::size_t const x = p[0] + _offset;
+      std::size_t const y = p[1] + _offset;
+      assert(x >> page_bits < _pages_per_side);
+      assert(y >> page_bits < _pages_per_side);
+      cell = ((x & page_mask) << page_bits) | (y & page_mask);
+      return (x >> page_bits) * _pages_per_side + (y >> page_bits);
+    }
+
+  public:
+    grid(unsigned int N = 0)
+      : _offset(N)
+      , _pages_per_side((2 * N + 1 + page_mask) >> page_bits)
+      , _pages(_pages_per_side * _pages_per_side)
+      , _allocated(0)
+    { }
+
+    // the pages point into the slabs
+    grid(grid const&) = delete;
+    grid(grid&&) = default;
+
+    Value& operator[](point const& p)
+    {
+      std::size_t cell;
+      auto& page = _pages[locate(p, cell)];
+      if (not page) {
+        if (_allocated % (slab_pages * page_cells) == 0)
+          _slabs.emplace_back(slab_pages * page_cells);
+        page = _slabs.back().data() + _allocated % (slab_pages * page_cells);
+        _allocated += page_cells;
+      }
+      return page[cell];
+    }
+
+    Value const* find(point const& p) const
+    {
+      std::size_t cell;
+      Value* const page = _pages[locate(p, cell)];
+      return page ? &page[cell] : nullptr;
+    }
+
+    std::size_t size() const { return _allocated; }
+  };
+}
+
+#endif // SITES_HPP
+
+// vim: noai:ts=2:sw=2
@@ -0,0 +1,135 @@
+/*
+ * snapshot_writer.hpp
+ *
+ */
+
+#ifndef SNAPSHOT_WRITER_HPP
+#define SNAPSHOT_WRITER_HPP
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+namespace algorithm {
+  //
+  // Writes snapshots (see basic_instance::snapshot_type) on a thread of its
+  // own, so that the sampler never waits for the datafile, and the thread
+  // asking for checkpoints only does when all the buffers are queued.
+  //
+  // submit() fills a snapshot buffer and queues it for writing. At most
+  // max_in_flight buffers exist at a time, which bounds the memory used
+  // for snapshots; submit() waits for one to be written when they are all
+  // queued. Buffers are reused once written, which also makes filling them
+  // cheaper (see basic_instance::snapshot).
+  //
+  // All the writes happen on the writer thread, in the order of submit().
+  //
+  template<typename Snapshot>
+  class snapshot_writer {
+    std::function<void(Snapshot const&)> const write;
+    unsigned int const max_in_flight;
+
+    boost::mutex mutex;
+    boost::condition_variable changed;
+    std::vector<std::unique_ptr<Snapshot>> free;
+    std::deque<std::unique_ptr<Snapshot>> queue;
+    unsigned int allocated;
+    bool closing;
+
+    boost::thread thread;
+
+  public:
+    snapshot_writer(std::function<void(Snapshot const&)> write,
+                    unsigned int max_in_flight)
+      : write(write)
+      , max_in_flight(std::max(max_in_flight, 1u))
+      , allocated(0)
+      , closing(false)
+      , thread([this] { run(); })
+    {
+    }
+
+    ~snapshot_writer()
+    {
+      close();
+    }
+
+    // fill(Snapshot&) is called with a free buffer, from the calling thread
+    template<typename Fill>
+    void submit(Fill fill)
+    {
+      std::unique_ptr<Snapshot> s;
+      {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        changed.wait(lock, [this] {
+            return not free.empty() or allocated < max_in_flight;
+          });
+        if (free.empty()) {
+          free.emplace_back(new Snapshot);
+          allocated++;
+        }
+        s = std::move(free.back());
+        free.pop_back();
+      }
+
+      fill(*s);
+
+      boost::lock_guard<boost::mutex> lock(mutex);
+      queue.push_back(std::move(s));
+      changed.notify_all();
+    }
+
+    // write what has been submitted and stop the writer thread
+    void close()
+    {
+      {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        closing = true;
+        changed.notify_all();
+      }
+      if (thread.joinable())
+        thread.join();
+    }
+
+  private:
+    void run()
+    {
+      boost::unique_lock<boost::mutex> lock(mutex);
+      while (true) {
+        changed.wait(lock, [this] { return not queue.empty() or closing; });
+        if (queue.empty())
+          return;
+
+        std::unique_ptr<Snapshot> s = std::move(queue.front());
+        queue.pop_front();
+
+        lock.unlock();
+        try {
+          write(*s);
+        } catch (std::exception const& e) {
+          // a failed checkpoint is no reason to lose the run, the next
+          // one may well succeed
+          std::cerr << "writing a snapshot failed: " << e.what() << "\n";
+        } catch (...) {
+          std::cerr << "writing a snapshot failed\n";
+        }
+        lock.lock();
+
+        free.push_back(std::move(s));
+        changed.notify_all();
+      }
+    }
+  };
+}
+
+#endif // SNAPSHOT_WRITER_HPP
+
+// vim: noai:ts=2:sw=2
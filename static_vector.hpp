@@ -0,0 +1,95 @@
+/*
+ * static_vector.hpp
+ *
+ */
+
+#ifndef STATIC_VECTOR_HPP
+#define STATIC_VECTOR_HPP
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <initializer_list>
+
+//
+// A vector with its elements stored inline, up to a fixed capacity, so that
+// it never allocates. Elements beyond size() are default constructed and
+// left alone, T should therefore be cheap to construct and copy.
+//
+template<typename T, std::size_t Capacity>
+class static_vector {
+public:
+  typedef std::size_t size_type;
+
+  typedef T        value_type;
+  typedef T&       reference;
+  typedef T const& const_reference;
+
+  typedef T*       iterator;
+  typedef T const* const_iterator;
+
+private:
+  std::array<T, Capacity> __data;
+  size_type __size;
+
+public:
+  static_vector() : __size(0) { }
+
+  static_vector(std::initializer_list<T> list) : __size(0)
+  {
+    assign(list.begin(), list.end());
+  }
+
+  template<typename InputIterator>
+  void assign(InputIterator first, InputIterator last)
+  {
+    clear();
+    for (; first != last; ++first)
+      push_back(*first);
+  }
+
+  static constexpr size_type capacity() { return Capacity; }
+
+  size_type size() const { return __size; }
+  bool empty() const { return __size == 0; }
+
+  iterator begin() { return __data.data(); }
+  iterator end()   { return __data.data() + __size; }
+
+  const_iterator begin() const { return __data.data(); }
+  const_iterator end()   const { return __data.data() + __size; }
+
+  reference       operator[](size_type i)       { return __data[i]; }
+  const_reference operator[](size_type i) const { return __data[i]; }
+
+  reference       front()       { assert(__size > 0); return __data[0]; }
+  const_reference front() const { assert(__size > 0); return __data[0]; }
+
+  reference       back()       { assert(__size > 0); return __data[__size - 1]; }
+  const_reference back() const { assert(__size > 0); return __data[__size - 1]; }
+
+  void push_back(const_reference x)
+  {
+    assert(__size < Capacity);
+    __data[__size++] = x;
+  }
+
+  void pop_back()
+  {
+    assert(__size > 0);
+    --__size;
+  }
+
+  // only shrinks or regrows over elements that were there already
+  void resize(size_type n)
+  {
+    assert(n <= Capacity);
+    __size = n;
+  }
+
+  void clear() { __size = 0; }
+};
+
+#endif // STATIC_VECTOR_HPP
+
+// vim: noai:ts=2:sw=2
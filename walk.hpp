@@ -7,21 +7,81 @@
 #define WALK_HPP__
 
 #include <cassert>
+#include <cstdint>
 #include <iterator>
 #include <iostream>
 #include <vector>
-#include <unordered_map>
+
+#include "sites.hpp"
+#include "static_vector.hpp"
 
 namespace models {
-  template<typename Lattice>
+  namespace detail {
+    //
+    // A walk enters and leaves a site through two of its six segments,
+    // numbered by walk::segment_code. We call this (unordered) pair a cut:
+    // there are 15 of them and the cuts at a site are stored as a 15 bits
+    // mask. A new cut (j, k) is only allowed if it is strictly nested with
+    // every cut (a, b) already there, i.e.
+    //
+    //   (a < j and k < b) or (j < a and b < k)  with j < k and a < b
+    //
+    // so for each (j, k) we tabulate the mask of cuts it conflicts with.
+    //
+    struct cut_tables_type {
+      uint16_t cut[6][6];        // the bit of cut (j, k), 0 when j == k
+      uint16_t conflicts[6][6];  // the cuts that (j, k) cannot coexist with
+    };
+
+    constexpr cut_tables_type make_cut_tables()
+    {
+      cut_tables_type t{};
+      int bit = 0;
+      for (int j = 0; j != 6; ++j)
+        for (int k = j + 1; k != 6; ++k) {
+          t.cut[j][k] = t.cut[k][j] = 1u << bit++;
+        }
+
+      for (int j = 0; j != 6; ++j)
+        for (int k = j + 1; k != 6; ++k)
+          for (int a = 0; a != 6; ++a)
+            for (int b = a + 1; b != 6; ++b)
+              if (not ((a < j and k < b) or (j < a and b < k)))
+                t.conflicts[j][k] = t.conflicts[k][j] |= t.cut[a][b];
+      return t;
+    }
+
+    constexpr cut_tables_type cut_tables = make_cut_tables();
+  }
+
+  //
+  // Sites selects the table holding the record of each visited site, see
+  // sites.hpp. A record keeps both the cuts at the site and the number of
+  // times the walk visited it, so that a step costs a single lookup shared
+  // with the features (multiplicity) reading the visits. The walk keeps a
+  // pointer to the record of each of its sites: the tables never move a
+  // record once created.
+  //
+  template<typename Lattice,
+           template<typename, typename> class Sites = sites::hashed>
   class walk {
   public:
     typedef Lattice lattice_type;
     typedef typename lattice_type::point point;
+    typedef uint16_t cut_set;
+
+    struct site_record {
+      cut_set cuts;
+      unsigned char visits;   // the first visit of the origin is not counted
+    };
+
+    typedef Sites<lattice_type, site_record> sites_type;
+    typedef static_vector<point, lattice_type::coordination> atmosphere_type;
 
   private:
-    std::unordered_map<point, std::vector<std::pair<int, int>>, typename lattice_type::hash> _cuts;
+    sites_type _sites;
     std::vector<point> _walk;
+    std::vector<site_record*> _records;
 
     using value_type = typename std::vector<point>::value_type;
     using iterator = typename std::vector<point>::iterator;
@@ -30,11 +90,12 @@ namespace models {
 
   public:
     walk(unsigned int N = 0)
+      : _sites(N)
     {
       _walk.reserve(N + 1);
+      _records.reserve(N + 1);
       _walk.push_back(lattice_type::origin());
-      // this is enough to default construct _cuts[(0,0)]
-      _cuts[lattice_type::origin()];
+      _records.push_back(&_sites[lattice_type::origin()]);
     }
 
     std::size_t size() const
@@ -56,11 +117,14 @@ namespace models {
     value_type front() const { return _walk.front(); }
     value_type back()  const { return _walk.back(); }
 
+    // how many times the walk has been at its last site
+    unsigned int visits() const { return _records.back()->visits; }
+
     //////////////////////////////////////////////////////////////////////
 
     bool check_step(point z) const
     {
-      if (_walk.size() < 1)
+      if (_walk.size() < 2)
         return true;
 
       auto y = _walk[_walk.size()-1];
@@ -69,57 +133,27 @@ namespace models {
       if (y == lattice_type::origin() and z == _walk[1])
         return false;
 
-      if (_walk.size() < 2)
-        return true;
-
       auto x = _walk[_walk.size()-2];
 
-      int j = segment_code(y, z);
-      int k = segment_code(y, x);
-      if (j > k) std::swap(k, j);
-
-//       std::cerr << "[check] points " << x << " " << y << " " << z
-//         << " would enter from " << j << " and exit through " << k;
-
-      if (j == k) {
-//         std::cerr << " no good (backstep)\n";
-        return false;
-      }
-
-      auto it = _cuts.find(y);
-      if (it == _cuts.end() or it->second.empty()) {
-//         std::cerr << " good (not visited)\n";
-        return true;
-      }
-
-      auto& cuts_y = it->second;
-
-//       std::cerr << " cuts: ";
-//       for (auto i : cuts_y)
-//         std::cerr << i.first << "-" << i.second << " ";
-
-      for (auto i : cuts_y) {
-        auto a = i.first, b = i.second;
-        if (!((a < j and k < b) or (j < a and b < k))) {
-//           std::cerr << " no good (crosses or segment already visited)\n";
-          return false;
-        }
-      }
-
-//       std::cerr << " good\n";
-      return true;
+      return allowed(segment_code(y, z), segment_code(y, x),
+                     _records.back()->cuts);
     }
 
+    // the segments from a site to its neighbours
     static int segment_code(point x, point y) {
       auto delta = y - x;
 
-      if (delta == point{-1, 0}) return 0;
-      if (delta == point{ 0, 1}) return 1;
-      if (delta == point{ 1, 1}) return 2;
-      if (delta == point{ 1, 0}) return 3;
-      if (delta == point{ 0,-1}) return 4;
-      if (delta == point{-1,-1}) return 5;
-      abort();
+      //                                 dy = -1  0  1
+      static const signed char codes[] = {     5, 0, -1,   // dx = -1
+                                               4, -1, 1,   // dx =  0
+                                              -1, 3,  2 }; // dx =  1
+
+      if (delta[0] < -1 or delta[0] > 1 or delta[1] < -1 or delta[1] > 1)
+        abort();
+      int const code = codes[3 * (delta[0] + 1) + delta[1] + 1];
+      if (code < 0)
+        abort();
+      return code;
     }
 
     void register_step(point z)
@@ -130,24 +164,23 @@ namespace models {
 
         int j = segment_code(y, z);
         int k = segment_code(y, x);
-        if (j > k) std::swap(k, j);
-
-        _cuts[y].push_back({j, k});
 
-//         std::cout << "points " << x << " " << y << " " << z
-//           << " enters from " << j << " and exits through " << k;
-//
-//         std::cerr << " cuts: ";
-//         for (auto i : _cuts[y])
-//           std::cerr << i.first << "-" << i.second << " ";
-//         std::cerr << "\n";
+        _records.back()->cuts |= detail::cut_tables.cut[j][k];
       }
       _walk.push_back(z);
+
+      auto& record = _sites[z];
+      record.visits ++;
+      _records.push_back(&record);
     }
 
     void unregister_step()
     {
       assert(not _walk.empty());
+      assert(_records.back()->visits > 0);
+      _records.back()->visits --;
+      _records.pop_back();
+
       if (_walk.size() > 2) {
         auto z = _walk[_walk.size()-1];
         auto y = _walk[_walk.size()-2];
@@ -155,27 +188,53 @@ namespace models {
 
         int j = segment_code(y, z);
         int k = segment_code(y, x);
-        if (k > j) std::swap(k, j);
 
-        auto& cuts_y = _cuts[y];
-        auto it = find(cuts_y.begin(), cuts_y.end(), std::make_pair(k, j));
-        assert(it != cuts_y.end());
-        cuts_y.erase(it);
+        auto& cuts_y = _records.back()->cuts;
+        assert(cuts_y & detail::cut_tables.cut[j][k]);
+        cuts_y &= ~detail::cut_tables.cut[j][k];
       }
       _walk.pop_back();
     }
 
-    std::vector<point> atmosphere() const
+    sites_type const& sites() const { return _sites; }
+
+    //
+    // The steps allowed by check_step, reading the cuts at the last site
+    // only once
+    //
+    atmosphere_type atmosphere() const
     {
-      std::vector<point> atmosphere;
-      atmosphere.reserve(lattice_type::coordination);
-      for (auto x: lattice_type::get_neighbours(back())) {
-        if (check_step(x))
-          atmosphere.push_back(x);
+      atmosphere_type atmosphere;
+
+      auto const y = back();
+      auto const neighbours = lattice_type::get_neighbours(y);
+
+      if (_walk.size() < 2) {
+        atmosphere.assign(neighbours.begin(), neighbours.end());
+        return atmosphere;
+      }
+
+      auto const x = _walk[_walk.size()-2];
+      int const k = segment_code(y, x);
+      cut_set const cuts = _records.back()->cuts;
+      bool const closed = y == lattice_type::origin();
+
+      for (auto z: neighbours) {
+        if (closed and z == _walk[1])
+          continue;
+        if (allowed(segment_code(y, z), k, cuts))
+          atmosphere.push_back(z);
       };
       return atmosphere;
     }
 
+  private:
+    // can a walk that entered its last site through k leave it through j?
+    static bool allowed(int j, int k, cut_set cuts)
+    {
+      return j != k and (cuts & detail::cut_tables.conflicts[j][k]) == 0;
+    }
+
     friend
     std::ostream& operator<<(std::ostream& o, walk const& walk)
     {
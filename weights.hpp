@@ -0,0 +1,255 @@
+/*
+ * weights.hpp
+ *
+ */
+
+#ifndef WEIGHTS_HPP
+#define WEIGHTS_HPP
+
+#include "my_array.hpp"
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+//
+// Arithmetic types for the flatperm weights and the histograms summing
+// them, to be used in place of long double (see basic_instance). Besides
+// double and long double there are
+//
+//   double_double  a pair of doubles with about 106 bits of mantissa, at
+//                  the cost of a few double operations each
+//   log_weight     the logarithm of the weight as a double, which never
+//                  overflows during a run however long the walks and
+//                  whatever mu is
+//
+// Both can be constructed from a long double and explicitly converted back
+// to one; the datafile keeps storing long double histograms for all of
+// them. These overflow to infinity beyond about 1e4932, which still bounds
+// the weights that a log_weight run can save.
+//
+namespace weights {
+  //////////////////////////////////////////////////////////////////////
+  // double-double
+  //////////////////////////////////////////////////////////////////////
+
+  class double_double {
+    double hi, lo;   // unevaluated sum, |lo| <= ulp(hi) / 2
+
+    double_double(double hi, double lo) : hi(hi), lo(lo) { }
+
+    // error free transformations
+    static double_double two_sum(double a, double b) {
+      double const s = a + b;
+      double const bb = s - a;
+      return double_double(s, (a - (s - bb)) + (b - bb));
+    }
+
+    static double_double quick_two_sum(double a, double b) {
+      double const s = a + b;
+      return double_double(s, b - (s - a));
+    }
+
+    static double_double two_prod(double a, double b) {
+      double const p = a * b;
+#ifdef FP_FAST_FMA
+      return double_double(p, std::fma(a, b, -p));
+#else
+      // Dekker's product
+      double const split = 134217729.0;   // 2^27 + 1
+      double const ta = split * a, a_hi = ta - (ta - a), a_lo = a - a_hi;
+      double const tb = split * b, b_hi = tb - (tb - b), b_lo = b - b_hi;
+      return double_double(p, ((a_hi * b_hi - p) + a_hi * b_lo + a_lo * b_hi)
+                           + a_lo * b_lo);
+#endif
+    }
+
+  public:
+    double_double(long double x = 0)
+      : hi(double(x)), lo(double(x - (long double) hi)) { }
+
+    explicit operator long double() const {
+      return (long double) hi + lo;
+    }
+
+    friend double_double operator+(double_double const& a, double_double const& b) {
+      double_double s = two_sum(a.hi, b.hi);
+      double_double const t = two_sum(a.lo, b.lo);
+      s.lo += t.hi;
+      s = quick_two_sum(s.hi, s.lo);
+      s.lo += t.lo;
+      return quick_two_sum(s.hi, s.lo);
+    }
+
+    friend double_double operator*(double_double const& a, double_double const& b) {
+      double_double p = two_prod(a.hi, b.hi);
+      p.lo += a.hi * b.lo + a.lo * b.hi;
+      return quick_two_sum(p.hi, p.lo);
+    }
+
+    friend double_double operator/(double_double const& a, double_double const& b) {
+      double const q1 = a.hi / b.hi;
+      double_double r = a + double_double(-1) * b * double_double(q1, 0);
+      double const q2 = r.hi / b.hi;
+      r = r + double_double(-1) * b * double_double(q2, 0);
+      double const q3 = r.hi / b.hi;
+      double_double const q = quick_two_sum(q1, q2);
+      return q + double_double(q3, 0);
+    }
+
+    double_double& operator+=(double_double const& b) { return *this = *this + b; }
+    double_double& operator*=(double_double const& b) { return *this = *this * b; }
+    double_double& operator/=(double_double const& b) { return *this = *this / b; }
+
+    friend bool operator<(double_double const& a, double_double const& b) {
+      return a.hi < b.hi or (a.hi == b.hi and a.lo < b.lo);
+    }
+
+    friend bool operator>(double_double const& a, double_double const& b) { return b < a; }
+
+    friend double_double floor(double_double const& a) {
+      double const hi = std::floor(a.hi);
+      if (hi != a.hi)
+        return double_double(hi, 0);
+      return quick_two_sum(hi, std::floor(a.lo));
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////
+  // log-space
+  //////////////////////////////////////////////////////////////////////
+
+  //
+  // Only non-negative weights can be represented, which is all flatperm
+  // needs; zero is log = -infinity.
+  //
+  class log_weight {
+    double l;
+
+    struct from_log { };
+    log_weight(double l, from_log) : l(l) { }
+
+  public:
+    log_weight(long double x = 0)
+      : l(x > 0 ? double(std::log(x)) : -std::numeric_limits<double>::infinity())
+    {
+      assert(x >= 0);
+    }
+
+    explicit operator long double() const {
+      return std::exp((long double) l);
+    }
+
+    double log() const { return l; }
+
+    friend log_weight operator+(log_weight const& a, log_weight const& b) {
+      double const m = std::max(a.l, b.l);
+      double const d = std::min(a.l, b.l) - m;
+      // also when both are zero, as -inf - -inf is not a number
+      if (not (d > -std::numeric_limits<double>::infinity()))
+        return a.l < b.l ? b : a;
+      return log_weight(m + std::log1p(std::exp(d)), from_log());
+    }
+
+    friend log_weight operator*(log_weight const& a, log_weight const& b) {
+      return log_weight(a.l + b.l, from_log());
+    }
+
+    friend log_weight operator/(log_weight const& a, log_weight const& b) {
+      return log_weight(a.l - b.l, from_log());
+    }
+
+    log_weight& operator+=(log_weight const& b) { return *this = *this + b; }
+    log_weight& operator*=(log_weight const& b) { l += b.l; return *this; }
+    log_weight& operator/=(log_weight const& b) { l -= b.l; return *this; }
+
+    friend bool operator<(log_weight const& a, log_weight const& b) { return a.l < b.l; }
+    friend bool operator>(log_weight const& a, log_weight const& b) { return a.l > b.l; }
+
+    friend log_weight floor(log_weight const& a) {
+      return log_weight(std::floor(static_cast<long double>(a)));
+    }
+  };
+
+  //////////////////////////////////////////////////////////////////////
+
+  // the histograms as stored in the datafile
+  template<typename Weight, size_t D, typename Layout>
+  my_array<long double, D, Layout> to_long_double(my_array<Weight, D, Layout> const& h)
+  {
+    my_array<long double, D, Layout> result(std::vector<size_t>(h.shape(), h.shape() + D));
+    std::transform(h.begin(), h.end(), result.begin(),
+                   [](Weight const& w) { return static_cast<long double>(w); });
+    return result;
+  }
+
+  template<typename Weight, size_t D, typename Layout>
+  void from_long_double(my_array<long double, D, Layout> const& h,
+                        my_array<Weight, D, Layout>& result)
+  {
+    std::transform(h.begin(), h.end(), result.begin(),
+                   [](long double x) { return Weight(x); });
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+
+namespace hdf5 {
+  template<typename Weight, size_t D, typename Layout>
+  void load_weights(handle loc, my_array<Weight, D, Layout>& h, const char* name,
+                    storage const& s)
+  {
+    auto tmp = weights::to_long_double(h);
+    load(loc, tmp, name, s);
+    weights::from_long_double(tmp, h);
+  }
+
+  template<typename Weight, size_t D, typename Layout>
+  void save_weights(handle loc, my_array<Weight, D, Layout> const& h, const char* name,
+                    storage const& s, dirty_rows const* dirty)
+  {
+    save(loc, weights::to_long_double(h), name, s, dirty);
+  }
+
+  template<typename Weight, size_t D, typename Layout>
+  void append_weights(handle loc, my_array<Weight, D, Layout> const& h, const char* name,
+                      storage const& s, hsize_t stride)
+  {
+    append(loc, weights::to_long_double(h), name, s, stride);
+  }
+
+  template<size_t D, typename Layout>
+  void load(handle loc, my_array<weights::double_double, D, Layout>& h, const char* name,
+            storage const& s = storage())
+  { load_weights(loc, h, name, s); }
+
+  template<size_t D, typename Layout>
+  void save(handle loc, my_array<weights::double_double, D, Layout> const& h, const char* name,
+            storage const& s = storage(), dirty_rows const* dirty = nullptr)
+  { save_weights(loc, h, name, s, dirty); }
+
+  template<size_t D, typename Layout>
+  void append(handle loc, my_array<weights::double_double, D, Layout> const& h, const char* name,
+              storage const& s = storage(), hsize_t stride = 1)
+  { append_weights(loc, h, name, s, stride); }
+
+  template<size_t D, typename Layout>
+  void load(handle loc, my_array<weights::log_weight, D, Layout>& h, const char* name,
+            storage const& s = storage())
+  { load_weights(loc, h, name, s); }
+
+  template<size_t D, typename Layout>
+  void save(handle loc, my_array<weights::log_weight, D, Layout> const& h, const char* name,
+            storage const& s = storage(), dirty_rows const* dirty = nullptr)
+  { save_weights(loc, h, name, s, dirty); }
+
+  template<size_t D, typename Layout>
+  void append(handle loc, my_array<weights::log_weight, D, Layout> const& h, const char* name,
+              storage const& s = storage(), hsize_t stride = 1)
+  { append_weights(loc, h, name, s, stride); }
+}
+
+#endif // WEIGHTS_HPP
+
+// vim: noai:ts=2:sw=2